@@ -0,0 +1,257 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <asio_stream_compressor/asio_stream_compressor.h>
+#include <asio_stream_compressor/detail/wait_queue.h>
+#include <boost/asio.hpp>
+
+namespace asio = asio_stream_compressor::asio;
+namespace ip = asio::ip;
+
+using clock_type = std::chrono::steady_clock;
+
+// Measures the cost of serializing concurrent operations. The first part
+// compares the wait queue of the compressor with the deadline timer lock it
+// replaced, the second part runs concurrent 16 byte reads through a
+// compressor over a loopback socket pair.
+
+namespace
+{
+double ns_per_op(clock_type::duration time, std::size_t ops)
+{
+  return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+                 .count())
+      / static_cast<double>(ops);
+}
+
+/**
+ * @brief The timer_lock class is the lock the compressor used before the
+ * wait queue. The expiry time of a timer tells if the lock is taken, waiters
+ * wait on the timer and unlocking cancels all of them, so every waiter wakes
+ * up and tries again.
+ */
+class timer_lock
+{
+public:
+  explicit timer_lock(asio::io_context& ctx)
+      : timer_(ctx)
+  {
+    timer_.expires_at(clock_type::time_point::min());
+  }
+
+  template<class Function>
+  void lock(Function f)
+  {
+    if (timer_.expiry() != clock_type::time_point::max()) {
+      timer_.expires_at(clock_type::time_point::max());
+      asio::post(timer_.get_executor(), std::move(f));
+      return;
+    }
+    timer_.async_wait([this, f](asio_stream_compressor::error_code)
+                      { lock(f); });
+  }
+
+  void unlock()
+  {
+    timer_.expires_at(clock_type::time_point::min());
+  }
+
+private:
+  asio::steady_timer timer_;
+};
+
+/**
+ * @brief The queue_lock class passes the lock to the first waiter like the
+ * read and write locks of the compressor.
+ */
+class queue_lock
+{
+public:
+  struct waiter : asio_stream_compressor::detail::wait_queue_node<waiter>
+  {
+    std::function<void()> resume;
+  };
+
+  explicit queue_lock(asio::io_context& ctx)
+      : ctx_(ctx)
+  {
+  }
+
+  void lock(waiter& w)
+  {
+    if (lock_.try_lock()) {
+      asio::post(ctx_, w.resume);
+      return;
+    }
+    lock_.wait(&w);
+  }
+
+  void unlock()
+  {
+    if (waiter* next = lock_.unlock()) {
+      asio::post(ctx_, next->resume);
+    }
+  }
+
+private:
+  asio::io_context& ctx_;
+  asio_stream_compressor::detail::operation_lock<waiter> lock_;
+};
+
+double run_timer_lock(std::size_t workers, std::size_t ops)
+{
+  asio::io_context ctx;
+  timer_lock lock(ctx);
+  std::size_t left = ops;
+  std::function<void()> step = [&]
+  {
+    if (left == 0)
+      return;
+    --left;
+    lock.lock(
+        [&]
+        {
+          asio::post(ctx,
+                     [&]
+                     {
+                       lock.unlock();
+                       step();
+                     });
+        });
+  };
+
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < workers; ++i) {
+    step();
+  }
+  ctx.run();
+  return ns_per_op(clock_type::now() - start, ops);
+}
+
+double run_queue_lock(std::size_t workers, std::size_t ops)
+{
+  asio::io_context ctx;
+  queue_lock lock(ctx);
+  std::size_t left = ops;
+  std::vector<queue_lock::waiter> waiters(workers);
+  for (auto& w : waiters) {
+    auto* self = &w;
+    w.resume = [&, self]
+    {
+      asio::post(ctx,
+                 [&, self]
+                 {
+                   lock.unlock();
+                   if (left != 0) {
+                     --left;
+                     lock.lock(*self);
+                   }
+                 });
+    };
+  }
+
+  auto start = clock_type::now();
+  for (auto& w : waiters) {
+    if (left != 0) {
+      --left;
+      lock.lock(w);
+    }
+  }
+  ctx.run();
+  return ns_per_op(clock_type::now() - start, ops);
+}
+
+std::string make_payload(std::size_t size)
+{
+  static const std::string words[] = {
+      "alpha ", "beta ", "gamma ", "delta ", "epsilon ", "zeta ", "eta "};
+  std::string payload;
+  payload.reserve(size + 16);
+  for (std::size_t i = 0; payload.size() < size; ++i) {
+    payload += words[(i * 7 + i / 3) % 7];
+  }
+  payload.resize(size);
+  return payload;
+}
+
+double run_reads(std::size_t readers, const std::string& payload)
+{
+  using compressor = asio_stream_compressor::compressor<ip::tcp::socket>;
+
+  asio::io_context ctx;
+  ip::tcp::acceptor acceptor(ctx,
+                             ip::tcp::endpoint(ip::address_v4::loopback(), 0));
+  compressor writer(ctx);
+  compressor reader(ctx);
+  writer.next_layer().connect(acceptor.local_endpoint());
+  acceptor.accept(reader.next_layer());
+
+  std::size_t received = 0;
+  std::size_t reads = 0;
+  std::vector<std::array<char, 16>> buffers(readers);
+  std::function<void(std::size_t)> read = [&](std::size_t i)
+  {
+    if (received >= payload.size())
+      return;
+    reader.async_read_some(asio::buffer(buffers[i]),
+                           [&, i](asio_stream_compressor::error_code ec,
+                                  std::size_t bytes)
+                           {
+                             ++reads;
+                             received += bytes;
+                             if (!ec) {
+                               read(i);
+                             }
+                           });
+  };
+
+  auto start = clock_type::now();
+  asio::async_write(
+      writer,
+      asio::buffer(payload),
+      [](asio_stream_compressor::error_code ec, std::size_t)
+      {
+        if (ec) {
+          std::cerr << "write failed: " << ec.message() << "\n";
+        }
+      });
+  for (std::size_t i = 0; i < readers; ++i) {
+    read(i);
+  }
+  while (received < payload.size() && ctx.run_one() != 0) {
+  }
+  auto time = clock_type::now() - start;
+  return ns_per_op(time, reads);
+}
+
+}  // namespace
+
+auto main() -> int
+{
+  constexpr std::size_t lock_ops = 1000000;
+  const std::size_t concurrency[] = {1, 8, 64};
+
+  std::cout << "lock and unlock, ns per operation\n"
+            << "  waiters   timer lock   wait queue\n";
+  for (std::size_t n : concurrency) {
+    std::cout << std::setw(9) << n << std::setw(13) << std::fixed
+              << std::setprecision(1) << run_timer_lock(n, lock_ops)
+              << std::setw(13) << run_queue_lock(n, lock_ops) << "\n";
+  }
+
+  std::string payload = make_payload(4 * 1024 * 1024);
+  std::cout << "\n16 byte reads of 4 MiB through a compressor, ns per read\n"
+            << "  readers\n";
+  for (std::size_t n : concurrency) {
+    std::cout << std::setw(9) << n << std::setw(13) << run_reads(n, payload)
+              << "\n";
+  }
+  return 0;
+}
@@ -13,6 +13,7 @@ default(
     include/*.hpp
     test/*.cpp test/*.hpp
     example/*.cpp example/*.hpp
+    benchmark/*.cpp benchmark/*.hpp
 )
 default(FIX NO)
 
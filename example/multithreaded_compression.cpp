@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <asio_stream_compressor/asio_stream_compressor.h>
+#include <boost/asio.hpp>
+#include <boost/asio/spawn.hpp>
+
+namespace asio = asio_stream_compressor::asio;
+namespace ip = asio::ip;
+
+// Sends a large stream through compressors with a growing number of zstd
+// workers and prints the throughput of each run.
+
+static const size_t STREAM_SIZE = 256 * 1024 * 1024;
+
+std::string make_payload()
+{
+  // text like data that compresses about 3:1
+  static const char words[][8] = {
+      "asio", "stream", "zstd", "worker", "thread", "buffer", "frame", "job"};
+  std::mt19937 rng(42);
+  std::string payload;
+  while (payload.size() < 16 * 1024 * 1024) {
+    payload += words[rng() % 8];
+    payload += static_cast<char>('0' + rng() % 10);
+    payload += ' ';
+  }
+  return payload;
+}
+
+void drain(ip::tcp::socket& sock, boost::asio::yield_context yield)
+{
+  static char buf[1024 * 1024];
+  asio_stream_compressor::error_code ec;
+  while (!ec) {
+    sock.async_read_some(asio::buffer(buf), yield[ec]);
+  }
+}
+
+void run(asio::io_context& ctx,
+         int workers,
+         const std::string& payload,
+         boost::asio::yield_context yield)
+{
+  ip::tcp::acceptor acceptor(ctx, ip::tcp::endpoint(ip::tcp::v4(), 0));
+  ip::tcp::socket receiver(ctx);
+  asio_stream_compressor::compressor<ip::tcp::socket> sock(ctx, 3);
+
+  try {
+    sock.next_layer().async_connect(acceptor.local_endpoint(), yield);
+    acceptor.async_accept(receiver, yield);
+    asio::spawn(ctx.get_executor(),
+                std::bind(drain, std::ref(receiver), std::placeholders::_1),
+                boost::asio::detached);
+
+    sock.set_flush_policy(asio_stream_compressor::flush_policy::manual());
+    if (workers != 0) {
+      if (auto ec = sock.set_compression_workers(workers)) {
+        std::cerr << "workers are not supported: " << ec.message() << "\n";
+        return;
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t sent = 0; sent < STREAM_SIZE; sent += payload.size()) {
+      asio::async_write(sock, asio::buffer(payload), yield);
+    }
+    sock.async_flush(yield);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    sock.next_layer().close();
+
+    auto& stat = sock.get_statistics();
+    std::cout << "workers: " << workers << "\tMB/s: "
+              << static_cast<double>(stat.tx_bytes_total.load())
+            / elapsed.count() / 1e6
+              << "\tratio: "
+              << static_cast<double>(stat.tx_bytes_total.load())
+            / static_cast<double>(stat.tx_bytes_compressed.load())
+              << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << "\n";
+  }
+}
+
+auto main() -> int
+{
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  cores = std::max(cores, 1);
+  std::string payload = make_payload();
+
+  asio::io_context ctx;
+  asio::spawn(ctx.get_executor(),
+              [&](boost::asio::yield_context yield)
+              {
+                for (int workers = 0; workers <= cores;
+                     workers = workers == 0 ? 1 : workers * 2)
+                {
+                  run(ctx, workers, payload, yield);
+                }
+              },
+              boost::asio::detached);
+  ctx.run();
+
+  return 0;
+}
@@ -2,6 +2,15 @@
 
 #include <type_traits>
 
+#include "detail/buffer_pool.h"
+#include "detail/codec.h"
+#include "detail/decode_limits.h"
+#include "detail/dictionary.h"
+#include "detail/dictionary_trainer.h"
+#include "detail/flush_policy.h"
+#include "detail/handshake_operation.h"
+#include "detail/compression_thread_pool.h"
+#include "detail/context_pool.h"
 #include "detail/read_operation.h"
 #include "detail/write_operation.h"
 
@@ -30,13 +39,30 @@ namespace asio_stream_compressor
  * t.join();
  * @endcode
  *
+ * Allocator provides memory of the internal buffers, of the zstd contexts
+ * and of asynchronous operations. zstd allocates from its worker threads and
+ * operations may allocate on the compute executor, so the allocator must be
+ * thread safe if either of them is used. See pmr.h for a compressor that
+ * takes its memory from a std::pmr::memory_resource. zstd contexts use the
+ * allocator only with ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL, see
+ * detail/zstd_api.h, otherwise they use the default zstd allocator.
+ *
+ * The codec is a template parameter resolved at compile time. zstd_codec is
+ * the default and supports every option of this class, identity_codec and
+ * lz4_codec (lz4_codec.h) only support the options every codec has.
+ * Functions a codec does not support fail to compile when they are called.
+ *
  * Implements traits: AsyncReadStream, AsyncWriteStream
  */
-template<class Stream, class Allocator = std::allocator<char>>
+template<class Stream,
+         class Allocator = std::allocator<char>,
+         class Codec = zstd_codec>
 class compressor
 {
 public:
-  using self = compressor<Stream, Allocator>;
+  using self = compressor<Stream, Allocator, Codec>;
+  /// The codec that compresses the data.
+  using codec_type = Codec;
 
   /// The type of the next layer.
   using next_layer_type = typename std::remove_reference<Stream>::type;
@@ -55,7 +81,7 @@ public:
   template<typename Executor>
   compressor(Executor& ex, const Allocator& alloc = Allocator()) noexcept(false)
       : next_layer_(Stream(ex))
-      , core_(ZSTD_defaultCLevel(), next_layer_.get_executor(), alloc)
+      , core_(Codec::default_level(), next_layer_.get_executor(), alloc)
   {
   }
 
@@ -87,7 +113,7 @@ public:
   compressor(Stream&& next_layer,
              const Allocator& alloc = Allocator()) noexcept(false)
       : next_layer_(std::move(next_layer))
-      , core_(ZSTD_defaultCLevel(), next_layer_.get_executor(), alloc)
+      , core_(Codec::default_level(), next_layer_.get_executor(), alloc)
   {
   }
 
@@ -110,6 +136,10 @@ public:
 
   compressor(const self&) = delete;
 
+  /**
+   * @brief compressor - moves a compressor whose codec allows it. zstd_codec
+   * does not, its timers refer to the compressor that armed them.
+   */
   compressor(self&&) = default;
 
   self& operator=(const self&) = delete;
@@ -149,7 +179,8 @@ public:
           typename asio::default_completion_token<executor_type>::type())
   {
     return asio::async_initiate<ReadToken, void(error_code, std::size_t)>(
-        detail::initiate_async_read_some<self, decltype(core_)>(*this, core_),
+        typename Codec::template initiate_read_some<self, core_type>(*this,
+                                                                     core_),
         token,
         buffers);
   }
@@ -179,17 +210,29 @@ public:
    * @warning number of bytes in the callback will be equal to size of the
    * provided buffers or 0 if not all of them could be transferred. This is
    * because of difficulties of mapping provided byted to compressed bytes.
+   * When set_write_some_limit() is used at most the limit is consumed and the
+   * callback reports exactly the number of consumed bytes.
    *
-   * This method flushes data to the next layer to ensure that the decoder on
-   * the other side is able to decode it. For small writes this may not be
-   * optimal because additional bytes have to be written by the encoder. This is
-   * why usage of boost::asio::buffered_stream is recommended in such case.
+   * By default this method flushes data to the next layer to ensure that the
+   * decoder on the other side is able to decode it. For small writes this may
+   * not be optimal because additional bytes have to be written by the encoder.
+   * Use set_flush_policy() to let several writes share one flush and
+   * async_flush() to force buffered data out.
    *
    * @code
-   * boost::asio::buffered_stream<
-   *   asio_stream_compressor::compressor<ip::tcp::socket>>
-   *   sock(ctx, 8192, 8192);
+   * sock.set_flush_policy(asio_stream_compressor::flush_policy::manual());
+   * asio::async_write(sock, header, yield);
+   * asio::async_write(sock, body, yield);
+   * sock.async_flush(yield);
    * @endcode
+   *
+   * The completion handler may be called before the data reaches the next
+   * layer if the flush policy did not require a flush.
+   *
+   * Writes started while another write is in progress are queued. When the
+   * running write finishes, all queued writes are compressed together and sent
+   * with one flush and one write to the next layer. Each handler still
+   * receives its own number of bytes, in the order the writes were started.
    */
   template<typename ConstBufferSequence,
            typename WriteToken =
@@ -200,11 +243,108 @@ public:
           typename asio::default_completion_token<executor_type>::type())
   {
     return asio::async_initiate<WriteToken, void(error_code, std::size_t)>(
-        detail::initiate_async_write_some<self, decltype(core_)>(*this, core_),
+        typename Codec::template initiate_write_some<self, core_type>(*this,
+                                                                      core_),
         token,
         buffers);
   }
 
+  /**
+   * @brief async_flush flushes all data buffered by the encoder to the next
+   * layer
+   *
+   * @param token The @ref completion_token that will be used to produce a
+   * completion handler, which will be called when the flush completes.
+   *
+   * @tparam FlushToken - completion handler with signature @code void
+   * (error_code) @endcode
+   *
+   * The operation is queued after all previously started async_write_some()
+   * operations. Regardless of whether the asynchronous operation completes
+   * immediately or not, the completion handler will not be invoked from within
+   * this function.
+   */
+  template<typename FlushToken =
+               typename asio::default_completion_token<executor_type>::type>
+  auto async_flush(
+      FlushToken&& token =
+          typename asio::default_completion_token<executor_type>::type())
+  {
+    return asio::async_initiate<FlushToken, void(error_code)>(
+        typename Codec::template initiate_flush<self, core_type>(*this, core_),
+        token);
+  }
+
+  /**
+   * @brief async_handshake exchanges capabilities with the peer and
+   * configures the compressor for them
+   *
+   * @param options - preferences sent to the peer
+   * @param token The @ref completion_token that will be used to produce a
+   * completion handler, which will be called when the handshake completes.
+   *
+   * @tparam HandshakeToken - completion handler with signature @code void
+   * (error_code) @endcode
+   *
+   * Both peers send a small record with the largest window their decoder
+   * accepts, the IDs of their decoder dictionaries, the level they prefer to
+   * receive and whether they want compression at all, then read the record
+   * of the peer. Afterwards:
+   * - the encoder window is limited to what the peer accepts,
+   * - the encoder uses its dictionary if the peer has it, otherwise the
+   *   newest decoder dictionary the peer has, otherwise none,
+   * - the encoder uses the level preferred by the peer unless the adaptive
+   *   level is enabled, up to handshake_options::max_level() or by default
+   *   the level it already uses, so a peer cannot make it more expensive,
+   * - if either peer asked for no compression, data is passed to and from
+   *   the next layer as is in both directions and no zstd context is ever
+   *   created,
+   * - a history passed to resume_session() primes a direction only if the
+   *   peer resumed the same history for it.
+   *
+   * So windows and dictionaries can be rolled out across a fleet gradually:
+   * add a dictionary to decoders first, encoders use it once the peer
+   * announces it. Both peers must call this function before any other
+   * operation, the peer of a compressor that does not is not compatible.
+   * The handshake is not repeated by reset().
+   *
+   * @code
+   * sock.set_decode_limits(asio_stream_compressor::decode_limits()
+   *                            .max_window_log(20));
+   * sock.add_decoder_dictionary(dict);
+   * sock.async_handshake(asio_stream_compressor::handshake_options(), yield);
+   * @endcode
+   */
+  template<typename HandshakeToken =
+               typename asio::default_completion_token<executor_type>::type>
+  auto async_handshake(
+      const handshake_options& options,
+      HandshakeToken&& token =
+          typename asio::default_completion_token<executor_type>::type())
+  {
+    return asio::async_initiate<HandshakeToken, void(error_code)>(
+        detail::initiate_async_handshake<self, decltype(core_)>(*this, core_),
+        token,
+        options);
+  }
+
+  /**
+   * @brief async_handshake exchanges capabilities with the peer using
+   * default handshake_options
+   */
+  template<typename HandshakeToken =
+               typename asio::default_completion_token<executor_type>::type,
+           typename = std::enable_if_t<
+               !std::is_same<std::decay_t<HandshakeToken>,
+                             handshake_options>::value>>
+  auto async_handshake(
+      HandshakeToken&& token =
+          typename asio::default_completion_token<executor_type>::type())
+  {
+    return async_handshake(handshake_options(),
+                           std::forward<HandshakeToken>(token));
+  }
+
   /**
    * @brief next_layer returns next layer in the stack of stream layers.
    */
@@ -271,6 +411,221 @@ public:
     return core_.zstd_cctx_set_parameter(param, value);
   }
 
+  /**
+   * @brief set_compression_workers - compresses written data with several
+   * zstd worker threads
+   * @param workers - number of workers, 0 returns to single threaded mode
+   * @return error_code with zstd_error_category, for example if zstd was
+   * built without multithreading support
+   *
+   * Every compressor starts its own worker threads. Use the overload that
+   * takes a compression_thread_pool to share threads between connections,
+   * available with ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL.
+   *
+   * The workers compress jobs of several megabytes in parallel, so writes are
+   * pipelined: async_write_some() passes input to the workers in chunks and
+   * sends output as soon as the workers produce it. A flush waits until all
+   * running jobs are done and ends the jobs early, so use a flush policy that
+   * lets large amounts of data through between flushes. Waiting for the
+   * workers blocks the thread that runs the encoder, set_compute_executor()
+   * keeps it off the I/O executor.
+   *
+   * Example:
+   * @code
+   * sock.set_flush_policy(asio_stream_compressor::flush_policy::manual());
+   * sock.set_compression_workers(4);
+   * asio::async_write(sock, asio::buffer(large_file), yield);
+   * sock.async_flush(yield);
+   * @endcode
+   *
+   * @warning Call this function before the first write.
+   */
+  error_code set_compression_workers(int workers) noexcept
+  {
+    return core_.set_compression_workers(workers);
+  }
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  /**
+   * @brief set_compression_workers - compresses written data with several
+   * zstd worker threads that are taken from a shared pool
+   * @param workers - number of workers used by this compressor
+   * @param pool - thread pool shared between compressors
+   * @return error_code with zstd_error_category
+   *
+   * The compressor keeps a reference to the pool.
+   *
+   * @warning Call this function before the first write.
+   */
+  error_code set_compression_workers(
+      int workers, const compression_thread_pool& pool) noexcept
+  {
+    return core_.set_compression_workers(workers, pool);
+  }
+#endif
+
+  /**
+   * @brief set_context_pool - takes zstd contexts from a pool shared with
+   * other compressors
+   * @param pool - context pool, the compressor keeps a reference to it
+   *
+   * Contexts are taken from the pool by the first read or write that needs
+   * them and go back to the pool on reset() or destruction. Parameters set
+   * before that are applied when the context is taken. Contexts of a pool
+   * use the default zstd allocator. Encoders with compression workers are
+   * not returned to the pool.
+   *
+   * @warning Call this function before the first read or write.
+   */
+  void set_context_pool(const context_pool& pool) noexcept
+  {
+    core_.set_context_pool(&pool);
+  }
+
+  /**
+   * @brief set_buffer_pool - takes memory of the internal I/O buffers from a
+   * pool shared with other compressors
+   * @param pool - buffer pool, the compressor keeps a reference to it
+   *
+   * By default every buffer keeps the largest size it ever reached. With a
+   * pool a buffer holds a chunk only while it has data and gives it back as
+   * soon as the data is consumed, so memory of all connections follows the
+   * data in flight instead of the peak of each connection. Chunks of a pool
+   * do not come from the compressor allocator. A read that waits for the
+   * peer holds no chunk, it reads a few bytes into the compressor and takes
+   * a chunk once they arrive.
+   *
+   * @warning Call this function before the first read or write.
+   */
+  void set_buffer_pool(const buffer_pool& pool) noexcept
+  {
+    core_.set_buffer_pool(&pool);
+  }
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  /**
+   * @brief set_static_memory - builds the zstd contexts in workspaces of a
+   * fixed size, so zstd does not allocate while the compressor works
+   * @param level - compression level the encoder workspace is sized for
+   * @param window_log - window log of the encoder, also the largest window
+   * accepted by the decoder
+   * @return error_code on failure or empty error_code on success
+   *
+   * The workspaces are allocated by this call with the compressor allocator
+   * and memory_footprint() returns their exact size plus the internal
+   * buffers. Frames of the peer that need a larger window are rejected.
+   * Parameters that need more memory than the workspace has, like a larger
+   * window or compression workers, make compression fail with
+   * ZSTD_error_memory_allocation. reset() keeps the static contexts and the
+   * window, set_context_pool() replaces them.
+   *
+   * The encoder workspace fits the level and every lower level. While static
+   * contexts are used, zstd_cctx_set_parameter() and
+   * set_adaptive_compression_level() reject levels above it with
+   * ZSTD_error_parameter_outOfBound. An adaptive range set before is capped
+   * at the level, and a level preferred by the peer in async_handshake() is
+   * lowered to it.
+   *
+   * @code
+   * sock.set_static_memory(3, 17);
+   * std::cout << "bytes per connection: " << sock.memory_footprint();
+   * @endcode
+   *
+   * Static contexts are experimental zstd API, the function is available
+   * with ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL.
+   *
+   * @warning Call this function before the first read or write.
+   */
+  error_code set_static_memory(int level, int window_log) noexcept
+  {
+    return core_.set_static_memory(level, window_log);
+  }
+#endif
+
+  /**
+   * @brief set_hibernation - releases zstd contexts and buffers of an idle
+   * connection
+   * @param idle_time - time without new operations after which the memory
+   * is released, 0 disables hibernation. Disabled by default.
+   *
+   * A connection hibernates between one and two idle times after its last
+   * operation started. An open frame is ended with a flush first, because a
+   * new encoder could not continue it. The decoder is released only between
+   * frames, so it stays while the peer keeps a frame open. A read waiting for
+   * data does not prevent hibernation. The next operation takes new contexts
+   * from the context pool or creates them, which costs as much as the first
+   * operation of a new connection. Static contexts are kept, see
+   * set_static_memory().
+   *
+   * Use memory_footprint() to see the memory released.
+   *
+   * The flush that ends the frame is started by the compressor, so no handler
+   * reports when it is done. Destroying a compressor that owns the next layer
+   * while the flush runs is safe, the flush stops when the next layer is
+   * closed. If the next layer outlives the compressor, the flush would still
+   * send from buffers of the compressor. Stop it first: call this function
+   * with 0, so no new flush starts, and destroy the compressor from the
+   * handler of async_flush(), which completes after a flush in progress.
+   *
+   * @warning It is unsafe to call this function with a non zero idle_time if
+   * there is an active asynchronous operation in progress.
+   */
+  void set_hibernation(std::chrono::steady_clock::duration idle_time) noexcept
+  {
+    core_.set_hibernation(idle_time);
+  }
+
+  /**
+   * @brief memory_footprint - returns number of bytes held by the zstd
+   * contexts and internal buffers of the compressor
+   *
+   * Memory of the context pool and of asynchronous operations is not
+   * included.
+   */
+  std::size_t memory_footprint() const noexcept
+  {
+    return core_.memory_footprint();
+  }
+
+  /**
+   * @brief set_adaptive_compression_level - lets the compressor pick the
+   * compression level that gives the best throughput, similar to zstd --adapt
+   * @param min_level - lowest level the compressor may use
+   * @param max_level - highest level the compressor may use
+   * @return error_code with zstd_error_category if the range is invalid
+   *
+   * Writes measure time spent in the encoder and time the next layer needs to
+   * accept the encoded data. After every 256 KiB sent the level goes up by one
+   * if sending took clearly longer than encoding and down by one if encoding
+   * took clearly longer. A slow link therefore ends up with strong compression
+   * and a fast link with a level the CPU keeps up with.
+   *
+   * Without ZSTD_c_nbWorkers the encoder applies a new level with the next
+   * frame, so the compressor ends the current frame on the next flush. Data
+   * after that is compressed without the history of the previous frame.
+   *
+   * Pass min_level equal to max_level to go back to a fixed level. reset()
+   * restarts from the level provided in the constructor. With static
+   * contexts max_level must not exceed the level of set_static_memory().
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  error_code set_adaptive_compression_level(int min_level,
+                                            int max_level) noexcept
+  {
+    return core_.set_adaptive_compression_level(min_level, max_level);
+  }
+
+  /**
+   * @brief get_compression_level - returns compression level currently used by
+   * the encoder
+   */
+  int get_compression_level() const noexcept
+  {
+    return core_.get_compression_level();
+  }
+
   /**
    * @brief zstd_dctx_set_parameter
    * @param param - param listed in ZSTD_cParameter
@@ -282,6 +637,420 @@ public:
     return core_.zstd_dctx_set_parameter(param, value);
   }
 
+  /**
+   * @brief set_decode_limits - limits the window, the expansion ratio and
+   * the rate of data decoded from the peer
+   * @param limits - limits, see decode_limits
+   * @return error_code on failure or empty error_code on success
+   *
+   * Reads that exceed a limit fail with a decode_limit_error. The limits are
+   * checked while data is decoded, without another pass over it. They stay
+   * in effect after reset().
+   *
+   * @warning Call this function before the first read.
+   */
+  error_code set_decode_limits(const decode_limits& limits) noexcept
+  {
+    return core_.set_decode_limits(limits);
+  }
+
+  /**
+   * @brief set_encoder_dictionary - compresses new frames with a dictionary
+   * @param dict - dictionary, the compressor keeps a reference to it
+   *
+   * An open frame is ended on the next flush and the following frames use
+   * the dictionary, so the dictionary may be replaced while the connection
+   * is in use. Frames that use a dictionary are compressed with the level
+   * the dictionary was digested for, the level of the compressor applies
+   * again after clear_encoder_dictionary(). The peer needs the same
+   * dictionary, see add_decoder_dictionary(). The dictionary stays in effect
+   * after reset().
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_encoder_dictionary(const dictionary& dict) noexcept
+  {
+    core_.set_encoder_dictionary(&dict);
+  }
+
+  /**
+   * @brief clear_encoder_dictionary - compresses new frames without a
+   * dictionary
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void clear_encoder_dictionary() noexcept
+  {
+    core_.set_encoder_dictionary(nullptr);
+  }
+
+  /**
+   * @brief add_decoder_dictionary - lets the decoder read frames compressed
+   * with a dictionary
+   * @param dict - dictionary, the compressor keeps a reference to it
+   * @return error_code on failure or empty error_code on success
+   *
+   * The decoder picks the dictionary of every frame by the dictionary ID in
+   * the frame header, so several dictionaries may be added while the peers
+   * move from one to another. A dictionary with the same ID replaces the
+   * previous one. Frames whose dictionary was not added fail with
+   * ZSTD_error_dictionary_wrong. Dictionaries stay after reset().
+   *
+   * @code
+   * sock.add_decoder_dictionary(next_dict);
+   * sock.set_encoder_dictionary(next_dict);
+   * // after the peer switched too
+   * sock.remove_decoder_dictionary(prev_dict.id());
+   * @endcode
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  error_code add_decoder_dictionary(const dictionary& dict) noexcept
+  {
+    return core_.add_decoder_dictionary(dict);
+  }
+
+  /**
+   * @brief remove_decoder_dictionary - removes the decoder dictionary with
+   * the ID, a frame that is being decoded with it is finished first
+   * @param id - dictionary ID
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void remove_decoder_dictionary(unsigned id) noexcept
+  {
+    core_.remove_decoder_dictionary(id);
+  }
+
+  /**
+   * @brief set_dictionary_trainer - samples written data for a trainer and
+   * uses the dictionaries it publishes
+   * @param trainer - dictionary trainer, the compressor keeps a reference to
+   * it
+   *
+   * Every async_write_some() gives the beginning of its buffers to the
+   * trainer. When the trainer publishes a dictionary, the decoder accepts it
+   * in addition to the previous trained dictionary, see dictionary_trainer.
+   * The encoder keeps its dictionary until use_trained_dictionary() is
+   * called with the ID of a published dictionary. Sampling costs a copy of up
+   * to 8 KiB per write while the trainer collects samples.
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_dictionary_trainer(const dictionary_trainer& trainer) noexcept
+  {
+    core_.set_dictionary_trainer(&trainer);
+  }
+
+  /**
+   * @brief use_trained_dictionary - compresses new frames with the trained
+   * dictionary once the peer has it
+   * @param id - ID of a dictionary published by the trainer, 0 cancels a
+   * switch that did not happen yet
+   *
+   * Call it when the peer announced that its decoder accepts the dictionary,
+   * for example after it received the content from the publish handler and
+   * acknowledged it. The encoder switches with the next frame like after
+   * set_encoder_dictionary() if the dictionary the trainer published last has
+   * the ID, an open frame is ended on the next flush. A handshake keeps the
+   * pending switch only if the peer announces the ID, so the dictionary
+   * negotiated by async_handshake() is not replaced by one the peer lacks.
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void use_trained_dictionary(unsigned id) noexcept
+  {
+    core_.use_trained_dictionary(id);
+  }
+
+  /**
+   * @brief set_flush_policy - sets the policy used by async_write_some() to
+   * decide when buffered data is flushed to the next layer
+   * @param policy - flush policy, flush_policy::always() by default
+   *
+   * The new policy is applied by the next write operation.
+   *
+   * @warning When the policy has a deadline the compressor starts a background
+   * flush once the deadline expires. Like any other asynchronous operation it
+   * must complete before the compressor is destroyed, so call async_flush()
+   * and wait for it before closing the connection.
+   */
+  void set_flush_policy(const flush_policy& policy) noexcept
+  {
+    core_.set_flush_policy(policy);
+  }
+
+  /**
+   * @brief get_flush_policy - returns current flush policy
+   */
+  const flush_policy& get_flush_policy() const noexcept
+  {
+    return core_.get_flush_policy();
+  }
+
+  /**
+   * @brief set_compute_executor - moves compression and decompression of large
+   * chunks from the I/O executor to another executor
+   * @param ex - executor of a thread pool used for codec work
+   * @param min_size - chunks smaller than this number of bytes are processed
+   * on the I/O executor because posting them costs more than it saves
+   *
+   * Operations resume on their I/O executor after the codec work is done, so
+   * completion handlers are invoked in the same way as without the compute
+   * executor. A read and a write of the same compressor may use the compute
+   * executor at the same time because they use separate contexts.
+   *
+   * Example:
+   * @code
+   * boost::asio::thread_pool pool(4);
+   * sock.set_compute_executor(pool.get_executor());
+   * @endcode
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_compute_executor(const asio::any_io_executor& ex,
+                            std::size_t min_size = 64 * 1024) noexcept
+  {
+    core_.set_compute_executor(ex, min_size);
+  }
+
+  /**
+   * @brief set_max_read_size - limits number of bytes requested from the next
+   * layer by one read
+   * @param bytes - maximum read size, ZSTD_DStreamInSize() by default
+   *
+   * The size of each read adapts to the traffic. It follows the input size
+   * recommended by the decoder, grows while reads fill the whole buffer and
+   * shrinks when they return much less. A larger maximum means fewer system
+   * calls for bulk transfers at the cost of a larger input buffer.
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_max_read_size(std::size_t bytes) noexcept
+  {
+    core_.set_max_read_size(bytes);
+  }
+
+  /**
+   * @brief set_decode_ahead - decodes more data than a read operation asks for
+   * @param bytes - number of bytes decoded ahead, 0 disables it. Disabled by
+   * default.
+   *
+   * When a read fills the buffers passed to async_read_some() the decoder
+   * keeps going and stores up to bytes of decoded data. Following reads copy
+   * that data without entering the decoder and, if no other read is in
+   * progress, without taking the read lock. This helps protocols that read a
+   * small header before the message body.
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_decode_ahead(std::size_t bytes) noexcept
+  {
+    core_.set_decode_ahead(bytes);
+  }
+
+  /**
+   * @brief set_raw_bypass - sends buffers that look incompressible without
+   * compressing them
+   * @param min_size - buffers smaller than this number of bytes are always
+   * compressed, 0 disables the bypass. Disabled by default.
+   * @param max_entropy - estimated entropy in bits per byte above which a
+   * buffer is considered incompressible
+   *
+   * Every buffer passed to async_write_some() that is at least min_size bytes
+   * long is sampled by a byte histogram. Buffers above max_entropy, such as
+   * already compressed media, are stored in zstd raw blocks, which costs a
+   * copy instead of a full compression pass. The peer decodes them with a
+   * regular zstd decoder.
+   *
+   * Raw blocks need a frame of their own, so the encoder ends its current
+   * frame before them and the next compressed data starts without history.
+   * Small messages are not worth that: zstd already stores a block that does
+   * not compress with a 3 byte header, while a separate frame costs more.
+   *
+   * Example:
+   * @code
+   * sock.set_raw_bypass(4096);
+   * // header is compressed, jpeg body is sent raw
+   * std::array<asio::const_buffer, 2> msg {json_header, jpeg_body};
+   * asio::async_write(sock, msg, handler);
+   * @endcode
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_raw_bypass(std::size_t min_size, double max_entropy = 7.5) noexcept
+  {
+    core_.set_raw_bypass(min_size, max_entropy);
+  }
+
+  /**
+   * @brief set_auto_detect - lets a server accept peers that do not compress
+   * @param enabled - true to detect the peer by its first bytes. Disabled by
+   * default.
+   *
+   * The first read checks whether the data of the peer starts with the zstd
+   * frame magic. If it does not, the compressor passes data through as is in
+   * both directions, so plain and compressing clients can use the same port.
+   * Such a connection never creates zstd contexts and reads and writes go
+   * straight to the next layer.
+   *
+   * The peer is only known after the first read, writes started before it
+   * completes are compressed. Use it for protocols where the client speaks
+   * first.
+   *
+   * @warning Call this function before the first read or write.
+   */
+  void set_auto_detect(bool enabled) noexcept
+  {
+    core_.set_auto_detect(enabled);
+  }
+
+  /**
+   * @brief set_session_history - keeps the end of the data exchanged with
+   * the peer, so the session can be resumed after a reconnect
+   * @param bytes - number of bytes kept in each direction, 0 disables it.
+   * Disabled by default. More than the window of the encoder is not used.
+   * @return error_code with ZSTD_error_memory_allocation if the memory
+   * cannot be reserved
+   *
+   * Every byte written and read is copied once more, so enable it for
+   * connections that are expected to reconnect.
+   *
+   * @warning Call this function before the first read or write.
+   */
+  error_code set_session_history(std::size_t bytes) noexcept
+  {
+    return core_.set_session_history(bytes);
+  }
+
+  /**
+   * @brief export_session - returns the end of the data exchanged so far,
+   * called when the connection closes
+   *
+   * The histories of both peers only match if all data sent by either peer
+   * was read by the other, for example after a closing message of the
+   * protocol.
+   *
+   * @throws std::bad_alloc
+   */
+  session_history export_session() const
+  {
+    return core_.export_session();
+  }
+
+  /**
+   * @brief resume_session - primes a new connection with the history of the
+   * connection it replaces
+   * @return error_code with ZSTD_error_memory_allocation if the history
+   * cannot be copied
+   *
+   * The peers agree on the history in async_handshake(): both send hashes
+   * of the histories they resumed, and a direction is primed only if the
+   * sent history of one peer matches the received history of the other.
+   * Otherwise, for example if the peer did not resume or lost its history,
+   * the direction starts with an empty window. Without async_handshake()
+   * nothing is primed.
+   *
+   * The first frame of a primed direction refers to the history with
+   * ZSTD_CCtx_refPrefix(), so the first messages compress as well as on the
+   * old connection. It is preceded by a skippable frame with the hash of the
+   * history, and the decoder primes the frame that follows the marker. A
+   * marker for a history the decoder did not agree on is reported as
+   * session_error::history_mismatch.
+   *
+   * The history recorded for the next export continues from the primed one.
+   *
+   * Example:
+   * @code
+   * sock.set_session_history(64 * 1024);
+   * if (auto history = cache.take(token)) {
+   *   sock.resume_session(*history);
+   * }
+   * sock.async_handshake(asio_stream_compressor::handshake_options(), yield);
+   * // ... when the connection closes
+   * cache.store(token, sock.export_session());
+   * @endcode
+   *
+   * @warning Call this function before async_handshake().
+   */
+  error_code resume_session(const session_history& history) noexcept
+  {
+    return core_.resume_session(history);
+  }
+
+  /**
+   * @brief set_write_some_limit - limits number of bytes consumed by one
+   * async_write_some()
+   * @param max_input - maximum number of uncompressed bytes, 0 removes the
+   * limit. No limit by default.
+   *
+   * By default async_write_some() encodes and sends all provided buffers, so
+   * a large write holds the whole compressed payload and completes only when
+   * it was sent. With a limit the operation behaves like write_some() of a
+   * socket: it encodes at most max_input bytes, sends them and reports the
+   * number of consumed bytes. asio::async_write() continues with the rest,
+   * which bounds buffer growth and the time a single operation takes.
+   *
+   * Writes queued behind the lock owner are encoded together with its data
+   * only while the batch stays within the limit.
+   *
+   * @note asio::async_write() passes at most 64 KiB to each
+   * async_write_some(), so a limit of 64 KiB or more has no effect on writes
+   * it makes. Use a smaller limit with it, or call async_write_some() with
+   * the whole buffer.
+   *
+   * Example:
+   * @code
+   * sock.set_write_some_limit(16 * 1024);
+   * asio::async_write(sock, asio::buffer(large_payload), handler);
+   * @endcode
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_write_some_limit(std::size_t max_input) noexcept
+  {
+    core_.set_write_some_limit(max_input);
+  }
+
+  /**
+   * @brief set_write_pipeline - splits large writes into chunks and compresses
+   * the next chunk while the previous one is being sent
+   * @param chunk_size - number of uncompressed bytes in one chunk, 0 disables
+   * pipelining. Disabled by default.
+   *
+   * Without pipelining a write compresses all its data before the first byte
+   * is sent, so the output buffer grows with the size of the write. A
+   * pipelined write keeps at most two compressed chunks in memory and starts
+   * sending after the first chunk is compressed. Writes that are not larger
+   * than chunk_size are not affected.
+   *
+   * Chunks do not flush the encoder, so the compression ratio is the same as
+   * without pipelining. Combined with set_compute_executor() the chunks are
+   * compressed on the compute executor while the I/O executor sends.
+   *
+   * @note asio::async_write() passes at most 64 KiB to each
+   * async_write_some(), so only a chunk_size below 64 KiB splits writes it
+   * makes. Larger writes reach the pipeline through async_write_some().
+   *
+   * @warning It is unsafe to call this function if there is an active
+   * asynchronous operation in progress.
+   */
+  void set_write_pipeline(std::size_t chunk_size) noexcept
+  {
+    core_.set_write_pipeline(chunk_size);
+  }
+
   /**
    * @brief reset - resets internal structures
    *
@@ -301,6 +1070,11 @@ public:
 
   /**
    * @brief get_allocator - get compressor's allocator
+   *
+   * The allocator also provides memory of asynchronous operations whose
+   * completion handler has no associated allocator. That memory is recycled
+   * by the compressor, so reads and writes do not allocate once the first
+   * operations are done.
    */
   const Allocator& get_allocator() const noexcept
   {
@@ -330,8 +1104,10 @@ public:
   }
 
 private:
+  using core_type = typename Codec::template core<executor_type, Allocator>;
+
   Stream next_layer_;
-  detail::compression_core<executor_type, Allocator> core_;
+  core_type core_;
 };
 
 }  // namespace asio_stream_compressor
@@ -0,0 +1,3 @@
+#pragma once
+
+#include "detail/context_pool.h"
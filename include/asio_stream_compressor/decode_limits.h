@@ -0,0 +1,3 @@
+#pragma once
+
+#include "detail/decode_limits.h"
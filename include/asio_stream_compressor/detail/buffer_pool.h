@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The buffer_pool class keeps memory of I/O buffers released by
+ * compressors for the next compressors that need it.
+ *
+ * Memory is handed out in chunks of fixed sizes, powers of two from
+ * min_chunk_size to max_chunk_size. A compressor that uses a pool returns a
+ * chunk as soon as all data in it is consumed, so a burst on one connection
+ * does not leave megabytes on it, and the memory of all connections follows
+ * the data that is in flight. Larger chunks are not cached.
+ *
+ * The pool is split into shards selected by the calling thread, each shard
+ * keeps at most max_cached / shards bytes. Copies of a pool share the cached
+ * chunks. Each compressor keeps a copy until its chunks are returned, so
+ * the pool may go out of scope while connections still use it.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::buffer_pool pool;
+ * for (auto& sock : connections) {
+ *   sock.set_buffer_pool(pool);
+ * }
+ * @endcode
+ */
+class buffer_pool
+{
+public:
+  /** @brief size of the smallest chunk */
+  static constexpr std::size_t min_chunk_size = 4096;
+  /** @brief size of the largest cached chunk */
+  static constexpr std::size_t max_chunk_size = 4 * 1024 * 1024;
+
+  /**
+   * @brief buffer_pool - creates an empty pool
+   * @param max_cached - number of bytes kept by the pool, more released
+   * chunks are freed
+   * @param shards - number of shards, 0 means one per hardware thread
+   */
+  explicit buffer_pool(std::size_t max_cached = 64 * 1024 * 1024,
+                       std::size_t shards = 0)
+      : impl_(std::make_shared<impl>(max_cached, shards))
+  {
+  }
+
+  /**
+   * @brief acquire - returns a chunk of at least size bytes. Used by
+   * compressors.
+   * @param size - requested size, replaced with the size of the chunk
+   */
+  void* acquire(std::size_t& size) const
+  {
+    std::size_t index = size_class(size);
+    if (index == class_count) {
+      return ::operator new(size);
+    }
+
+    size = min_chunk_size << index;
+    impl::shard& s = impl_->local_shard();
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (chunk* c = s.free[index]) {
+        s.free[index] = c->next;
+        s.cached -= size;
+        return c;
+      }
+    }
+    return ::operator new(size);
+  }
+
+  /**
+   * @brief release - keeps the chunk for reuse or frees it
+   * @param size - size of the chunk returned by acquire()
+   */
+  void release(void* ptr, std::size_t size) const noexcept
+  {
+    std::size_t index = size_class(size);
+    if (index != class_count) {
+      impl::shard& s = impl_->local_shard();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (s.cached + size <= impl_->max_cached_per_shard) {
+        s.free[index] = new (ptr) chunk {s.free[index]};
+        s.cached += size;
+        return;
+      }
+    }
+    ::operator delete(ptr);
+  }
+
+  /**
+   * @brief cached_bytes - returns number of bytes kept by the pool
+   */
+  std::size_t cached_bytes() const
+  {
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < impl_->shard_count; ++i) {
+      impl::shard& s = impl_->shards[i];
+      std::lock_guard<std::mutex> lock(s.mutex);
+      bytes += s.cached;
+    }
+    return bytes;
+  }
+
+private:
+  static constexpr std::size_t class_count = 11;
+  static_assert(min_chunk_size << (class_count - 1) == max_chunk_size,
+                "size classes must cover all chunk sizes");
+
+  struct chunk
+  {
+    chunk* next;
+  };
+
+  /**
+   * @brief size_class - returns index of the smallest chunk size that fits
+   * size bytes or class_count if size is larger than max_chunk_size
+   */
+  static std::size_t size_class(std::size_t size) noexcept
+  {
+    std::size_t index = 0;
+    while (index != class_count && (min_chunk_size << index) < size) {
+      ++index;
+    }
+    return index;
+  }
+
+  struct impl
+  {
+    struct shard
+    {
+      std::mutex mutex;
+      chunk* free[class_count] = {};
+      std::size_t cached = 0;
+    };
+
+    impl(std::size_t max_cached, std::size_t shard_hint)
+        : shard_count(shard_hint != 0 ? shard_hint
+                                      : std::thread::hardware_concurrency())
+    {
+      if (shard_count == 0)
+        shard_count = 1;
+      max_cached_per_shard = max_cached / shard_count;
+      shards.reset(new shard[shard_count]);
+    }
+
+    ~impl()
+    {
+      for (std::size_t i = 0; i < shard_count; ++i) {
+        for (chunk*& head : shards[i].free) {
+          while (chunk* c = head) {
+            head = c->next;
+            ::operator delete(c);
+          }
+        }
+      }
+    }
+
+    shard& local_shard() noexcept
+    {
+      static thread_local const std::size_t hash =
+          std::hash<std::thread::id>()(std::this_thread::get_id());
+      return shards[hash % shard_count];
+    }
+
+    std::size_t shard_count;
+    std::size_t max_cached_per_shard;
+    std::unique_ptr<shard[]> shards;
+  };
+
+  std::shared_ptr<impl> impl_;
+};
+
+}  // namespace asio_stream_compressor
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <utility>
+
+#include "compression_core.h"
+#include "compressor_statistics.h"
+#include "defines.h"
+#include "handler_memory.h"
+#include "read_operation.h"
+#include "write_operation.h"
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The identity_core class is the state of a compressor that passes
+ * data through as is. It only holds what every codec provides.
+ */
+template<class Executor, class Allocator>
+class identity_core : public Allocator
+{
+public:
+  using self = identity_core<Executor, Allocator>;
+
+  identity_core(int, const Executor&, const Allocator& alloc)
+      : Allocator(alloc)
+  {
+  }
+
+  identity_core(self&&) = default;
+
+  self& operator=(self&&) = default;
+
+  void reset() noexcept
+  {
+    stats_.reset();
+  }
+
+  const Allocator& get_allocator() const noexcept
+  {
+    return *this;
+  }
+
+  compressor_statistics& get_statistics() noexcept
+  {
+    return stats_;
+  }
+
+  const compressor_statistics& get_statistics() const noexcept
+  {
+    return stats_;
+  }
+
+  int get_compression_level() const noexcept
+  {
+    return 0;
+  }
+
+private:
+  compressor_statistics stats_;
+};
+
+template<typename Stream, class Core>
+class initiate_identity_read_some
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_identity_read_some(Stream& stream, Core&)
+      : stream_(stream)
+  {
+  }
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler, class MutableBufferSequence>
+  void operator()(Handler&& handler,
+                  const MutableBufferSequence& buffers) const
+  {
+    stream_.next_layer().async_read_some(
+        buffers, std::forward<decltype(handler)>(handler));
+  }
+
+private:
+  Stream& stream_;
+};
+
+template<typename Stream, class Core>
+class initiate_identity_write_some
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_identity_write_some(Stream& stream, Core&)
+      : stream_(stream)
+  {
+  }
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler, class ConstBufferSequence>
+  void operator()(Handler&& handler, const ConstBufferSequence& buffers) const
+  {
+    stream_.next_layer().async_write_some(
+        buffers, std::forward<decltype(handler)>(handler));
+  }
+
+private:
+  Stream& stream_;
+};
+
+/**
+ * @brief The initiate_immediate_flush class completes async_flush() of
+ * codecs that flush on every write.
+ */
+template<typename Stream, class Core>
+class initiate_immediate_flush
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_immediate_flush(Stream& stream, Core&)
+      : stream_(stream)
+  {
+  }
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler>
+  void operator()(Handler&& handler) const
+  {
+    auto ex = asio::get_associated_executor(
+        handler, stream_.next_layer().get_executor());
+    auto alloc = asio::get_associated_allocator(handler);
+    asio::post(ex,
+               bind_allocator(alloc,
+                              [handler = std::forward<Handler>(
+                                   handler)]() mutable
+                              { handler(error_code()); }));
+  }
+
+private:
+  Stream& stream_;
+};
+
+}  // namespace detail
+
+/**
+ * @brief The zstd_codec struct selects the zstd streaming API, the default
+ * codec of compressor. Every option of compressor is available with it.
+ *
+ * A codec provides the state of the compressor as core and the functions
+ * that start its operations. compressor resolves them at compile time, so
+ * there is no virtual call between the stream and the codec.
+ */
+struct zstd_codec
+{
+  template<class Executor, class Allocator>
+  using core = detail::compression_core<Executor, Allocator>;
+
+  template<class Stream, class Core>
+  using initiate_read_some = detail::initiate_async_read_some<Stream, Core>;
+
+  template<class Stream, class Core>
+  using initiate_write_some = detail::initiate_async_write_some<Stream, Core>;
+
+  template<class Stream, class Core>
+  using initiate_flush = detail::initiate_async_flush<Stream, Core>;
+
+  static int default_level() noexcept
+  {
+    return ZSTD_defaultCLevel();
+  }
+};
+
+/**
+ * @brief The identity_codec struct passes data through as is.
+ *
+ * Reads and writes are forwarded to the next layer without a copy, so the
+ * codec is a baseline for measuring the cost of compression. Only the
+ * options every codec has are available, the statistics stay zero.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::compressor<ip::tcp::socket,
+ *                                    std::allocator<char>,
+ *                                    asio_stream_compressor::identity_codec>
+ *     sock(ctx);
+ * @endcode
+ */
+struct identity_codec
+{
+  template<class Executor, class Allocator>
+  using core = detail::identity_core<Executor, Allocator>;
+
+  template<class Stream, class Core>
+  using initiate_read_some = detail::initiate_identity_read_some<Stream, Core>;
+
+  template<class Stream, class Core>
+  using initiate_write_some =
+      detail::initiate_identity_write_some<Stream, Core>;
+
+  template<class Stream, class Core>
+  using initiate_flush = detail::initiate_immediate_flush<Stream, Core>;
+
+  static int default_level() noexcept
+  {
+    return 0;
+  }
+};
+
+}  // namespace asio_stream_compressor
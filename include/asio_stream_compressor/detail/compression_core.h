@@ -1,95 +1,424 @@
 #pragma once
 
+#include <chrono>
+#include <cstring>
 #include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
 
-#include <zstd.h>
-#include <zstd_errors.h>
-
+#include "compression_thread_pool.h"
 #include "compressor_statistics.h"
+#include "context_pool.h"
+#include "decode_limits.h"
+#include "dictionary.h"
+#include "dictionary_trainer.h"
+#include "entropy_estimator.h"
+#include "flush_policy.h"
+#include "handshake.h"
+#include "handler_memory.h"
+#include "io_buffer.h"
+#include "level_controller.h"
+#include "read_size_controller.h"
+#include "queued_operation.h"
+#include "raw_frame.h"
+#include "session.h"
+#include "zstd_api.h"
 #include "zstd_error_condition.h"
+#include "zstd_memory.h"
 
 namespace asio_stream_compressor
 {
 namespace detail
 {
-struct zstd_cstream_deleter
-{
-  void operator()(ZSTD_CCtx* ptr)
-  {
-    ZSTD_freeCStream(ptr);
-  }
-};
-
-struct zstd_dstream_deleter
-{
-  void operator()(ZSTD_DCtx* ptr)
-  {
-    ZSTD_freeDStream(ptr);
-  }
-};
-
-using zstd_cstream_uptr = std::unique_ptr<ZSTD_CStream, zstd_cstream_deleter>;
-using zstd_dstream_uptr = std::unique_ptr<ZSTD_DStream, zstd_dstream_deleter>;
+/**
+ * @brief default_window_log_limit - largest window a zstd decoder accepts
+ * unless ZSTD_d_windowLogMax says otherwise, ZSTD_WINDOWLOG_LIMIT_DEFAULT
+ */
+constexpr int default_window_log_limit = 27;
 
 template<class Executor, class Allocator>
 class compression_core : public Allocator
 {
 public:
   using self = compression_core<Executor, Allocator>;
+  using handler_allocator_type = handler_allocator<void, Allocator>;
 
   compression_core(int level, const Executor& ex, const Allocator& alloc)
       : Allocator(alloc)
       , compression_level_(level)
-      , cctx_(ZSTD_createCCtx())
-      , dctx_(ZSTD_createDCtx())
-      , pending_read_(ex)
-      , pending_write_(ex)
-      , input_buf_(std::numeric_limits<size_t>::max(), *this)
-      , write_buf_(std::numeric_limits<size_t>::max(), *this)
-  {
-    pending_read_.expires_at(neg_infin());
-    pending_write_.expires_at(neg_infin());
+      , zstd_memory_(make_zstd_memory(alloc))
+      , cctx_workspace_(alloc)
+      , dctx_workspace_(alloc)
+      , input_buf_(alloc)
+      , write_buf_(alloc)
+      , read_size_(ZSTD_DStreamInSize())
+      , decoded_buf_(alloc)
+      , pipeline_buf_(alloc)
+      , flush_policy_(flush_policy::always())
+      , flush_timer_(ex)
+      , idle_timer_(ex)
+      , lifetime_(std::make_shared<char>())
+      , handler_memory_(std::allocate_shared<handler_memory<Allocator>>(
+            alloc, alloc))
+  {
     auto ec = set_compression_level(compression_level_);
     if (ec) {
       throw system_error(ec);
     }
   }
 
-  compression_core(self&&) = default;
+  // handlers of the flush and idle timers refer to the core, a moved core
+  // would leave them with the moved-from object
+  compression_core(self&&) = delete;
 
-  self& operator=(self&&) = default;
+  self& operator=(self&&) = delete;
+
+  ~compression_core()
+  {
+    release_contexts();
+  }
 
   error_code zstd_cctx_set_parameter(ZSTD_cParameter param, int value) noexcept
   {
-    size_t status = ZSTD_CCtx_setParameter(cctx_.get(), param, value);
-    return make_error_code(ZSTD_getErrorCode(status));
+    // the static workspace only fits the levels it was sized for
+    if (param == ZSTD_c_compressionLevel && static_window_log_ != 0
+        && effective_level(value) > static_level_)
+    {
+      return make_error_code(ZSTD_error_parameter_outOfBound);
+    }
+
+    // the context may be created later, it gets the stored parameters then
+    if (cctx_) {
+      size_t status = ZSTD_CCtx_setParameter(cctx_.get(), param, value);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    } else if (param != ZSTD_c_compressionLevel && value != 0) {
+      // 0 selects the default, zstd clamps compression levels
+      ZSTD_bounds bounds = ZSTD_cParam_getBounds(param);
+      if (ZSTD_isError(bounds.error)) {
+        return make_error_code(ZSTD_getErrorCode(bounds.error));
+      }
+      if (value < bounds.lowerBound || value > bounds.upperBound) {
+        return make_error_code(ZSTD_error_parameter_outOfBound);
+      }
+    }
+
+    try {
+      store_parameter(cctx_params_, param, value);
+    } catch (const std::bad_alloc&) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+    if (param == ZSTD_c_compressionLevel) {
+      current_level_ = value;
+    } else if (param == ZSTD_c_nbWorkers) {
+      workers_ = value;
+    }
+    return error_code();
   }
 
   error_code zstd_dctx_set_parameter(ZSTD_dParameter param, int value) noexcept
   {
-    size_t status = ZSTD_DCtx_setParameter(dctx_.get(), param, value);
-    return make_error_code(ZSTD_getErrorCode(status));
+    if (dctx_) {
+      size_t status = ZSTD_DCtx_setParameter(dctx_.get(), param, value);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    } else if (param != ZSTD_d_windowLogMax || value != 0) {
+      // 0 selects the default window limit
+      ZSTD_bounds bounds = ZSTD_dParam_getBounds(param);
+      if (ZSTD_isError(bounds.error)) {
+        return make_error_code(ZSTD_getErrorCode(bounds.error));
+      }
+      if (value < bounds.lowerBound || value > bounds.upperBound) {
+        return make_error_code(ZSTD_error_parameter_outOfBound);
+      }
+    }
+
+    try {
+      store_parameter(dctx_params_, param, value);
+    } catch (const std::bad_alloc&) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+    return error_code();
   }
 
   void zstd_cctx_reset(ZSTD_ResetDirective reset) noexcept
   {
-    ZSTD_CCtx_reset(cctx_.get(), reset);
+    if (cctx_) {
+      ZSTD_CCtx_reset(cctx_.get(), reset);
+    }
+    if (reset != ZSTD_reset_session_only) {
+      // resetting parameters also drops the dictionary
+      cdict_in_use_.reset();
+      cctx_params_.clear();
+      current_level_ = ZSTD_defaultCLevel();
+      workers_ = 0;
+    }
   }
 
   void zstd_dctx_reset(ZSTD_ResetDirective reset) noexcept
   {
-    ZSTD_DCtx_reset(dctx_.get(), reset);
+    if (dctx_) {
+      ZSTD_DCtx_reset(dctx_.get(), reset);
+    }
+    if (reset != ZSTD_reset_session_only) {
+      ddict_in_use_.reset();
+      dctx_params_.clear();
+    }
+  }
+
+  /**
+   * @brief acquire_cctx - creates the encoder context or takes one from the
+   * context pool and applies the parameters set so far
+   */
+  error_code acquire_cctx() noexcept
+  {
+    zstd_cstream_uptr cctx;
+    try {
+      cctx = context_pool_ ? context_pool_->acquire_cctx()
+                           : make_zstd_cstream(zstd_memory_);
+    } catch (const std::bad_alloc&) {
+    }
+    if (!cctx) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+    if (thread_pool_) {
+      size_t status =
+          ZSTD_CCtx_refThreadPool(cctx.get(), thread_pool_->native_handle());
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    }
+#endif
+    for (const auto& p : cctx_params_) {
+      size_t status = ZSTD_CCtx_setParameter(cctx.get(), p.first, p.second);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    }
+    cctx_ = std::move(cctx);
+    cdict_in_use_.reset();
+    return error_code();
+  }
+
+  /**
+   * @brief acquire_dctx - creates the decoder context or takes one from the
+   * context pool and applies the parameters set so far
+   */
+  error_code acquire_dctx() noexcept
+  {
+    zstd_dstream_uptr dctx;
+    try {
+      dctx = context_pool_ ? context_pool_->acquire_dctx()
+                           : make_zstd_dstream(zstd_memory_);
+    } catch (const std::bad_alloc&) {
+    }
+    if (!dctx) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+
+    for (const auto& p : dctx_params_) {
+      size_t status = ZSTD_DCtx_setParameter(dctx.get(), p.first, p.second);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    }
+    dctx_ = std::move(dctx);
+    ddict_in_use_.reset();
+    return error_code();
+  }
+
+  /**
+   * @brief release_contexts - gives the contexts back to the context pool
+   */
+  void release_contexts() noexcept
+  {
+    if (!context_pool_)
+      return;
+
+    if (cctx_ && cctx_reusable()) {
+      context_pool_->release(std::move(cctx_));
+    }
+    if (dctx_) {
+      context_pool_->release(std::move(dctx_));
+    }
+  }
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  /**
+   * @brief set_static_memory - replaces the contexts with contexts that live
+   * in workspaces sized for the level and the window
+   */
+  error_code set_static_memory(int level, int window_log) noexcept
+  {
+    // static contexts never go to a pool
+    context_pool_.reset();
+    cctx_.reset();
+    dctx_.reset();
+    static_window_log_ = 0;
+
+    auto ec = set_compression_level(level);
+    if (!ec) {
+      ec = zstd_cctx_set_parameter(ZSTD_c_windowLog, window_log);
+    }
+    if (!ec) {
+      ec = zstd_dctx_set_parameter(ZSTD_d_windowLogMax, window_log);
+    }
+    if (ec) {
+      return ec;
+    }
+
+    // lower levels may use other tables, the workspace must fit all levels
+    // the encoder can switch to. Levels below 1 need less than level 1.
+    size_t cctx_size = 0;
+    for (int l = (std::min)(effective_level(level), 1);
+         l <= effective_level(level);
+         ++l)
+    {
+      size_t size = estimate_cstream_size(l);
+      if (ZSTD_isError(size)) {
+        return make_error_code(ZSTD_getErrorCode(size));
+      }
+      cctx_size = (std::max)(cctx_size, size);
+    }
+    size_t dctx_size = ZSTD_estimateDStreamSize(size_t(1) << window_log);
+    try {
+      cctx_workspace_.resize(workspace_units(cctx_size));
+      dctx_workspace_.resize(workspace_units(dctx_size));
+    } catch (const std::bad_alloc&) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+
+    // ZSTD_freeCCtx() refuses to free a static context, the workspace is
+    // released with the compressor
+    cctx_.reset(ZSTD_initStaticCCtx(cctx_workspace_.data(),
+                                    workspace_bytes(cctx_workspace_)));
+    dctx_.reset(ZSTD_initStaticDCtx(dctx_workspace_.data(),
+                                    workspace_bytes(dctx_workspace_)));
+    if (!cctx_ || !dctx_) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+
+    for (const auto& p : cctx_params_) {
+      size_t status = ZSTD_CCtx_setParameter(cctx_.get(), p.first, p.second);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    }
+    for (const auto& p : dctx_params_) {
+      size_t status = ZSTD_DCtx_setParameter(dctx_.get(), p.first, p.second);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    }
+    cdict_in_use_.reset();
+    ddict_in_use_.reset();
+    compression_level_ = level;
+    static_level_ = effective_level(level);
+    static_window_log_ = window_log;
+    level_controller_.limit(static_level_);
+    return error_code();
+  }
+#endif
+
+  /**
+   * @brief release_cctx - gives the encoder context back to the context pool
+   * or frees it
+   */
+  void release_cctx() noexcept
+  {
+    if (cctx_ && context_pool_ && cctx_reusable()) {
+      context_pool_->release(std::move(cctx_));
+    }
+    cctx_.reset();
+  }
+
+  /**
+   * @brief release_dctx - gives the decoder context back to the context pool
+   * or frees it
+   */
+  void release_dctx() noexcept
+  {
+    if (context_pool_ && dctx_) {
+      context_pool_->release(std::move(dctx_));
+    }
+    dctx_.reset();
+  }
+
+  void set_context_pool(const context_pool* pool) noexcept
+  {
+    // contexts are taken from the new pool when they are needed
+    cctx_.reset();
+    dctx_.reset();
+    cctx_workspace_ = zstd_workspace<Allocator>(get_allocator());
+    dctx_workspace_ = zstd_workspace<Allocator>(get_allocator());
+    static_window_log_ = 0;
+    if (pool) {
+      context_pool_ = *pool;
+    } else {
+      context_pool_.reset();
+    }
   }
 
   void reset()
   {
-    ZSTD_CCtx_reset(cctx_.get(),
-                    ZSTD_ResetDirective::ZSTD_reset_session_and_parameters);
-    ZSTD_DCtx_reset(dctx_.get(),
-                    ZSTD_ResetDirective::ZSTD_reset_session_and_parameters);
+    release_contexts();
+    if (cctx_) {
+      ZSTD_CCtx_reset(cctx_.get(),
+                      ZSTD_ResetDirective::ZSTD_reset_session_and_parameters);
+    }
+    if (dctx_) {
+      ZSTD_DCtx_reset(dctx_.get(),
+                      ZSTD_ResetDirective::ZSTD_reset_session_and_parameters);
+    }
+    cctx_params_.clear();
+    dctx_params_.clear();
+    cdict_in_use_.reset();
+    ddict_in_use_.reset();
     set_compression_level(compression_level_);
+    if (workers_ != 0) {
+      zstd_cctx_set_parameter(ZSTD_c_nbWorkers, workers_);
+    }
+    if (static_window_log_ != 0) {
+      zstd_cctx_set_parameter(ZSTD_c_windowLog, static_window_log_);
+      zstd_dctx_set_parameter(ZSTD_d_windowLogMax, static_window_log_);
+    }
+    if (decode_limits_.max_window_log() != 0) {
+      zstd_dctx_set_parameter(ZSTD_d_windowLogMax,
+                              decode_limits_.max_window_log());
+    }
+    decode_budget_.reset(decode_limits_.max_rate());
+    decode_credit_ = 0;
+    if (level_controller_.enabled()) {
+      level_controller_.restart(compression_level_);
+      set_compression_level(level_controller_.level());
+    }
+    end_frame_on_flush_ = false;
+    passthrough_ = false;
+    detect_pending_ = auto_detect_;
+    sent_history_.clear();
+    received_history_.clear();
+    std::string().swap(encoder_prefix_);
+    std::string().swap(decoder_prefix_);
+    encoder_prefix_pending_ = false;
+    decoder_prefix_pending_ = false;
+    decoder_prefix_armed_ = false;
     input_buf_.consume(input_buf_.size());
+    read_size_.reset();
+    decoder_between_frames_ = true;
+    decoded_buf_.consume(decoded_buf_.size());
     write_buf_.consume(write_buf_.size());
+    pipeline_buf_.consume(pipeline_buf_.size());
+    pipeline_error_ = error_code();
+    frame_open_ = false;
+    cancel_flush_timer();
+    cancel_idle_timer();
+    unflushed_bytes_ = 0;
+    flush_error_ = error_code();
     stats_.reset();
   }
 
@@ -113,17 +442,1060 @@ public:
     return zstd_cctx_set_parameter(ZSTD_c_compressionLevel, level);
   }
 
+  error_code set_compression_workers(int workers) noexcept
+  {
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+    auto ec = set_thread_pool(nullptr);
+    if (ec) {
+      return ec;
+    }
+#endif
+    return zstd_cctx_set_parameter(ZSTD_c_nbWorkers, workers);
+  }
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  error_code set_compression_workers(
+      int workers, const compression_thread_pool& pool) noexcept
+  {
+    auto ec = set_thread_pool(&pool);
+    if (ec) {
+      return ec;
+    }
+    return zstd_cctx_set_parameter(ZSTD_c_nbWorkers, workers);
+  }
+#endif
+
+  error_code set_adaptive_compression_level(int min_level,
+                                            int max_level) noexcept
+  {
+    ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_compressionLevel);
+    if (min_level > max_level || min_level < bounds.lowerBound
+        || max_level > bounds.upperBound)
+    {
+      return make_error_code(ZSTD_error_parameter_outOfBound);
+    }
+    if (static_window_log_ != 0 && effective_level(max_level) > static_level_)
+    {
+      return make_error_code(ZSTD_error_parameter_outOfBound);
+    }
+
+    level_controller_.enable(min_level, max_level, get_compression_level());
+    return set_compression_level(level_controller_.level());
+  }
+
+  /**
+   * @brief get_compression_level - returns level used by the encoder
+   */
+  int get_compression_level() const noexcept
+  {
+    return current_level_;
+  }
+
+  void record_encode_time(std::chrono::steady_clock::duration time) noexcept
+  {
+    if (level_controller_.enabled()) {
+      level_controller_.on_encoded(time);
+    }
+  }
+
+  void record_send_start() noexcept
+  {
+    if (level_controller_.enabled()) {
+      send_started_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  void record_send_end(std::size_t bytes) noexcept
+  {
+    if (level_controller_.enabled()) {
+      auto time = std::chrono::steady_clock::now() - send_started_;
+      level_controller_.on_sent(time, bytes);
+    }
+  }
+
+  /**
+   * @brief adapt_compression_level - switches the encoder to the level picked
+   * by the adaptive level controller
+   */
+  void adapt_compression_level() noexcept
+  {
+    if (!level_controller_.enabled() || !level_controller_.update())
+      return;
+
+    set_compression_level(level_controller_.level());
+    // a single threaded encoder applies new parameters with the next frame
+    if (frame_open_ && workers_ == 0) {
+      end_frame_on_flush_ = true;
+    }
+  }
+
+  void set_flush_policy(const flush_policy& policy) noexcept
+  {
+    flush_policy_ = policy;
+  }
+
+  const flush_policy& get_flush_policy() const noexcept
+  {
+    return flush_policy_;
+  }
+
+  void set_compute_executor(const asio::any_io_executor& ex,
+                            std::size_t min_size) noexcept
+  {
+    compute_executor_ = ex;
+    compute_min_size_ = min_size;
+  }
+
+  /**
+   * @brief offload_to_compute - returns true if processing of size bytes
+   * should be moved to the compute executor
+   */
+  bool offload_to_compute(std::size_t size) const noexcept
+  {
+    return compute_executor_ && size >= compute_min_size_;
+  }
+
+  /**
+   * @brief get_handler_allocator - returns allocator of operations whose
+   * handler has no associated allocator
+   */
+  handler_allocator_type get_handler_allocator() const noexcept
+  {
+    return handler_allocator_type(handler_memory_);
+  }
+
+  void set_max_read_size(std::size_t bytes) noexcept
+  {
+    read_size_.set_max_size(bytes);
+  }
+
+  void set_decode_ahead(std::size_t bytes) noexcept
+  {
+    decode_ahead_size_ = bytes;
+  }
+
+  void set_buffer_pool(const buffer_pool* pool) noexcept
+  {
+    input_buf_.set_pool(pool);
+    write_buf_.set_pool(pool);
+    decoded_buf_.set_pool(pool);
+    pipeline_buf_.set_pool(pool);
+  }
+
+  void set_hibernation(std::chrono::steady_clock::duration idle_time) noexcept
+  {
+    idle_time_ = idle_time;
+    if (idle_time_ == std::chrono::steady_clock::duration::zero()) {
+      cancel_idle_timer();
+    }
+  }
+
+  /**
+   * @brief note_activity - records the start of an operation
+   * @return true if the idle timer has to be armed
+   */
+  bool note_activity() noexcept
+  {
+    ++activity_;
+    return !idle_timer_armed_
+        && idle_time_ != std::chrono::steady_clock::duration::zero();
+  }
+
+  /**
+   * @brief hibernate_decoder - releases the decoder context and read buffers
+   * if the decoder is between frames and no data is buffered
+   * @return false if the decoder context is still in use
+   */
+  bool hibernate_decoder() noexcept
+  {
+    // a read waiting for the next layer does not use the decoder
+    bool reading = read_lock_.is_locked();
+    if (reading && !read_pending_)
+      return false;
+    if (input_buf_.size() != 0 || decoded_buf_.size() != 0)
+      return false;
+
+    // memory of static contexts is kept by design
+    if (dctx_ && static_window_log_ == 0) {
+      if (!decoder_between_frames_)
+        return false;
+      release_dctx();
+    }
+    decoded_buf_.shrink();
+    // the pending read owns the prepared part of input_buf_
+    if (!reading) {
+      input_buf_.shrink();
+    }
+    return true;
+  }
+
+  /**
+   * @brief hibernate_encoder - releases the encoder context and write buffers
+   * if no frame is open and no write is in progress
+   */
+  void hibernate_encoder() noexcept
+  {
+    if (write_lock_.is_locked() || pipeline_sending_ || frame_open_)
+      return;
+
+    if (static_window_log_ == 0) {
+      release_cctx();
+    }
+    write_buf_.shrink();
+    pipeline_buf_.shrink();
+  }
+
+  /**
+   * @brief memory_footprint - returns number of bytes held by the codec
+   * contexts and buffers
+   */
+  std::size_t memory_footprint() const noexcept
+  {
+    std::size_t size = input_buf_.capacity() + write_buf_.capacity()
+        + decoded_buf_.capacity() + pipeline_buf_.capacity();
+    if (static_window_log_ != 0) {
+      return size + workspace_bytes(cctx_workspace_)
+          + workspace_bytes(dctx_workspace_);
+    }
+    if (cctx_) {
+      size += ZSTD_sizeof_CCtx(cctx_.get());
+    }
+    if (dctx_) {
+      size += ZSTD_sizeof_DCtx(dctx_.get());
+    }
+    return size;
+  }
+
+  error_code set_decode_limits(const decode_limits& limits) noexcept
+  {
+    if (limits.max_window_log() != 0) {
+      auto ec = zstd_dctx_set_parameter(ZSTD_d_windowLogMax,
+                                        limits.max_window_log());
+      if (ec) {
+        return ec;
+      }
+    }
+    decode_limits_ = limits;
+    decode_budget_.reset(limits.max_rate());
+    return error_code();
+  }
+
+  void set_encoder_dictionary(const dictionary* dict) noexcept
+  {
+    if (dict) {
+      cdict_ = *dict;
+    } else {
+      cdict_.reset();
+    }
+    // the open frame keeps the dictionary it was started with
+    if (frame_open_) {
+      end_frame_on_flush_ = true;
+    }
+  }
+
+  void set_dictionary_trainer(const dictionary_trainer* trainer) noexcept
+  {
+    if (trainer) {
+      trainer_ = *trainer;
+    } else {
+      trainer_.reset();
+    }
+    encoder_generation_ = 0;
+    decoder_generation_ = 0;
+  }
+
+  /**
+   * @brief sample_write - gives the written data to the dictionary trainer
+   */
+  template<class ConstBufferSequence>
+  void sample_write(const ConstBufferSequence& buffers) const
+  {
+    if (trainer_) {
+      trainer_->add_sample(buffers);
+    }
+  }
+
+  /**
+   * @brief use_trained_dictionary - lets the encoder switch to the trained
+   * dictionary with the given ID, 0 cancels a pending switch
+   */
+  void use_trained_dictionary(unsigned id) noexcept
+  {
+    trained_cdict_id_ = id;
+    encoder_generation_ = 0;
+  }
+
+  /**
+   * @brief update_trained_encoder_dictionary - switches the encoder to the
+   * dictionary the trainer published last if the peer announced its ID
+   */
+  void update_trained_encoder_dictionary()
+  {
+    if (!trainer_ || trained_cdict_id_ == 0
+        || trainer_->generation() == encoder_generation_)
+    {
+      return;
+    }
+
+    encoder_generation_ = trainer_->generation();
+    auto dict = trainer_->get_dictionary();
+    if (dict && dict->id() == trained_cdict_id_) {
+      set_encoder_dictionary(&*dict);
+      trained_cdict_id_ = 0;
+    }
+  }
+
+  /**
+   * @brief update_trained_decoder_dictionaries - adds the dictionary the
+   * trainer published last to the decoder and removes the one published
+   * before the previous one
+   */
+  void update_trained_decoder_dictionaries()
+  {
+    if (!trainer_ || trainer_->generation() == decoder_generation_)
+      return;
+
+    decoder_generation_ = trainer_->generation();
+    auto dict = trainer_->get_dictionary();
+    if (!dict || dict->id() == trained_ddict_ids_[0])
+      return;
+    if (add_decoder_dictionary(*dict))
+      return;
+
+    if (trained_ddict_ids_[1] != 0) {
+      remove_decoder_dictionary(trained_ddict_ids_[1]);
+    }
+    trained_ddict_ids_[1] = trained_ddict_ids_[0];
+    trained_ddict_ids_[0] = dict->id();
+  }
+
+  /**
+   * @brief apply_encoder_dictionary - makes the encoder use the dictionary
+   * set last, called before a new frame is started
+   */
+  error_code apply_encoder_dictionary() noexcept
+  {
+    if (cdict_ == cdict_in_use_)
+      return error_code();
+
+    size_t status = ZSTD_CCtx_refCDict(
+        cctx_.get(), cdict_ ? cdict_->native_cdict() : nullptr);
+    if (ZSTD_isError(status)) {
+      return make_error_code(ZSTD_getErrorCode(status));
+    }
+    cdict_in_use_ = cdict_;
+    return error_code();
+  }
+
+  error_code add_decoder_dictionary(const dictionary& dict) noexcept
+  {
+    try {
+      for (auto& d : ddicts_) {
+        if (d.id() == dict.id()) {
+          d = dict;
+          return error_code();
+        }
+      }
+      ddicts_.push_back(dict);
+    } catch (const std::bad_alloc&) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+    return error_code();
+  }
+
+  void remove_decoder_dictionary(unsigned id) noexcept
+  {
+    for (auto it = ddicts_.begin(); it != ddicts_.end(); ++it) {
+      if (it->id() == id) {
+        ddicts_.erase(it);
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief has_decoder_dictionaries - returns true if the decoder has to
+   * pick a dictionary for every frame
+   */
+  bool has_decoder_dictionaries() const noexcept
+  {
+    return !ddicts_.empty() || ddict_in_use_;
+  }
+
+  /**
+   * @brief select_decoder_dictionary - makes the decoder use the dictionary
+   * whose ID is written in the header of the frame that starts at data
+   * @return 0 if the decoder is ready for the frame, number of bytes needed
+   * to read the frame header or a zstd error
+   *
+   * Frames with an unknown ID are decoded without a dictionary, so the
+   * decoder reports ZSTD_error_dictionary_wrong for them.
+   */
+  size_t select_decoder_dictionary(const void* data, std::size_t size) noexcept
+  {
+    // the decoder reports a malformed header
+    size_t status = missing_frame_header_bytes(data, size);
+    if (status != 0)
+      return status;
+
+    unsigned dict_id = ZSTD_getDictID_fromFrame(data, size);
+    const dictionary* dict = nullptr;
+    for (const auto& d : ddicts_) {
+      if (d.id() == dict_id) {
+        dict = &d;
+        break;
+      }
+    }
+    if (dict ? ddict_in_use_ == *dict : !ddict_in_use_)
+      return 0;
+
+    status = ZSTD_DCtx_refDDict(dctx_.get(),
+                                dict ? dict->native_ddict() : nullptr);
+    if (ZSTD_isError(status))
+      return status;
+    ddict_in_use_ = dict ? std::optional<dictionary>(*dict) : std::nullopt;
+    return 0;
+  }
+
+  /**
+   * @brief make_handshake_record - returns the capabilities of the decoder
+   * and the preferences of the options
+   */
+  handshake_record make_handshake_record(
+      const handshake_options& options) const noexcept
+  {
+    handshake_record record;
+    record.no_compression = !options.compression();
+    record.preferred_level = options.preferred_level();
+    record.max_window_log = default_window_log_limit;
+    for (const auto& p : dctx_params_) {
+      if (p.first == ZSTD_d_windowLogMax && p.second != 0) {
+        record.max_window_log = p.second;
+      }
+    }
+    // the newest dictionaries are announced if there are too many
+    std::size_t first = ddicts_.size() > handshake_record::max_dictionaries
+        ? ddicts_.size() - handshake_record::max_dictionaries
+        : 0;
+    for (std::size_t i = first; i < ddicts_.size(); ++i) {
+      record.add_dictionary(ddicts_[i].id());
+    }
+    if (!encoder_prefix_.empty()) {
+      record.sent_history_hash = encoder_prefix_hash_;
+    }
+    if (!decoder_prefix_.empty()) {
+      record.received_history_hash = decoder_prefix_hash_;
+    }
+    return record;
+  }
+
+  /**
+   * @brief apply_handshake - configures the encoder for the capabilities of
+   * the peer
+   */
+  error_code apply_handshake(const handshake_record& peer,
+                             const handshake_options& options) noexcept
+  {
+    if (peer.no_compression || !options.compression()) {
+      passthrough_ = true;
+      agree_session(false, false);
+      return error_code();
+    }
+    // a direction is primed only if the peer resumed the same history for
+    // it, otherwise it starts with an empty window
+    agree_session(
+        !encoder_prefix_.empty()
+            && peer.received_history_hash == encoder_prefix_hash_,
+        !decoder_prefix_.empty()
+            && peer.sent_history_hash == decoder_prefix_hash_);
+
+    // the peer is not trusted, a level zstd does not know is ignored and
+    // higher levels than allowed locally are capped
+    auto bounds = ZSTD_cParam_getBounds(ZSTD_c_compressionLevel);
+    if (peer.preferred_level != 0 && !level_controller_.enabled()
+        && peer.preferred_level >= bounds.lowerBound
+        && peer.preferred_level <= bounds.upperBound)
+    {
+      int level = (std::min)(peer.preferred_level,
+                             options.max_level() != 0
+                                 ? options.max_level()
+                                 : effective_level(current_level_));
+      if (static_window_log_ != 0) {
+        level = (std::min)(level, static_level_);
+      }
+      auto ec = set_compression_level(level);
+      if (ec) {
+        return ec;
+      }
+    }
+
+    // the window is fixed, so a higher level set later does not grow it
+    // beyond what the peer accepts. No level picks a window above the
+    // default limit, so a peer that accepts it needs no fixed window.
+    int window_log = cctx_parameter(ZSTD_c_windowLog);
+    if (window_log != 0 || peer.max_window_log < default_window_log_limit) {
+      if (window_log == 0) {
+        window_log = level_window_log(current_level_);
+      }
+      window_log = (std::min)(window_log, peer.max_window_log);
+      auto ec = zstd_cctx_set_parameter(
+          ZSTD_c_windowLog,
+          (std::max)(window_log,
+                     ZSTD_cParam_getBounds(ZSTD_c_windowLog).lowerBound));
+      if (ec) {
+        return ec;
+      }
+    }
+
+    // keep the encoder dictionary if the peer has it, otherwise take the
+    // newest dictionary both peers have
+    const dictionary* dict = nullptr;
+    if (cdict_ && peer.has_dictionary(cdict_->id())) {
+      dict = &*cdict_;
+    }
+    for (auto it = ddicts_.rbegin(); !dict && it != ddicts_.rend(); ++it) {
+      if (peer.has_dictionary(it->id())) {
+        dict = &*it;
+      }
+    }
+    set_encoder_dictionary(dict);
+    // a trained dictionary the peer does not have must not replace it
+    if (!peer.has_dictionary(trained_cdict_id_)) {
+      trained_cdict_id_ = 0;
+    }
+    return error_code();
+  }
+
+  error_code set_session_history(std::size_t bytes) noexcept
+  {
+    try {
+      sent_history_.set_capacity(bytes);
+      received_history_.set_capacity(bytes);
+    } catch (const std::bad_alloc&) {
+      sent_history_.set_capacity(0);
+      received_history_.set_capacity(0);
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+    return error_code();
+  }
+
+  session_history export_session() const
+  {
+    return session_history(sent_history_.str(), received_history_.str());
+  }
+
+  /**
+   * @brief resume_session - keeps the history until apply_handshake() tells
+   * which directions the peer resumed it for
+   */
+  error_code resume_session(const session_history& history) noexcept
+  {
+    try {
+      encoder_prefix_ = history.sent();
+      decoder_prefix_ = history.received();
+    } catch (const std::bad_alloc&) {
+      return make_error_code(ZSTD_error_memory_allocation);
+    }
+    encoder_prefix_hash_ = history_hash(encoder_prefix_);
+    decoder_prefix_hash_ = history_hash(decoder_prefix_);
+    encoder_prefix_pending_ = false;
+    decoder_prefix_pending_ = false;
+    decoder_prefix_armed_ = false;
+    return error_code();
+  }
+
+  /**
+   * @brief agree_session - primes the first frame of the directions both
+   * peers resumed the same history for and drops the history of the others,
+   * the history kept for the next export continues from the primed one
+   */
+  void agree_session(bool encoder, bool decoder) noexcept
+  {
+    if (!encoder) {
+      std::string().swap(encoder_prefix_);
+    }
+    if (!decoder) {
+      std::string().swap(decoder_prefix_);
+    }
+    encoder_prefix_pending_ = encoder;
+    decoder_prefix_pending_ = decoder;
+    sent_history_.clear();
+    sent_history_.append(encoder_prefix_.data(), encoder_prefix_.size());
+    received_history_.clear();
+    received_history_.append(decoder_prefix_.data(), decoder_prefix_.size());
+  }
+
+  void record_sent(const void* data, std::size_t size) noexcept
+  {
+    sent_history_.append(data, size);
+  }
+
+  void record_received(const void* data, std::size_t size) noexcept
+  {
+    received_history_.append(data, size);
+  }
+
+  /**
+   * @brief apply_encoder_prefix - makes the next frame refer to the resumed
+   * history, called before the frame is started
+   */
+  error_code apply_encoder_prefix() noexcept
+  {
+    size_t status = ZSTD_CCtx_refPrefix(
+        cctx_.get(), encoder_prefix_.data(), encoder_prefix_.size());
+    if (ZSTD_isError(status)) {
+      return make_error_code(ZSTD_getErrorCode(status));
+    }
+    encoder_prefix_pending_ = false;
+    // the prefix replaces the dictionary for one frame
+    cdict_in_use_.reset();
+    return error_code();
+  }
+
+  /**
+   * @brief read_session_marker - consumes the marker at the start of
+   * input_buf_ and arms the resumed history for the frame that follows
+   * @return number of bytes missing from the marker
+   */
+  std::size_t read_session_marker(error_code& ec) noexcept
+  {
+    bool found = false;
+    std::uint64_t hash = 0;
+    std::size_t missing = detail::read_session_marker(
+        static_cast<const unsigned char*>(input_buf_.data().data()),
+        input_buf_.size(),
+        found,
+        hash);
+    if (!found)
+      return missing;
+
+    input_buf_.consume(session_marker_size);
+    if (!decoder_prefix_pending_ || hash != decoder_prefix_hash_) {
+      ec = make_error_code(session_error::history_mismatch);
+      return 0;
+    }
+    decoder_prefix_pending_ = false;
+    decoder_prefix_armed_ = true;
+    return 0;
+  }
+
+  /**
+   * @brief apply_decoder_prefix - makes the decoder use the resumed history
+   * for the next frame if the peer announced it
+   */
+  error_code apply_decoder_prefix() noexcept
+  {
+    if (!decoder_prefix_armed_)
+      return error_code();
+
+    size_t status = ZSTD_DCtx_refPrefix(
+        dctx_.get(), decoder_prefix_.data(), decoder_prefix_.size());
+    if (ZSTD_isError(status)) {
+      return make_error_code(ZSTD_getErrorCode(status));
+    }
+    decoder_prefix_armed_ = false;
+    ddict_in_use_.reset();
+    return error_code();
+  }
+
+  /**
+   * @brief set_auto_detect - arms detection of a peer that does not compress
+   */
+  void set_auto_detect(bool enabled) noexcept
+  {
+    auto_detect_ = enabled;
+    detect_pending_ = enabled;
+  }
+
+  /**
+   * @brief detect_peer - switches to passthrough if input_buf_ does not start
+   * with the zstd frame magic or a skippable frame magic, such as the marker
+   * of a resumed session
+   * @return false if more bytes are needed to tell
+   */
+  bool detect_peer() noexcept
+  {
+    static constexpr unsigned char magic[4] = {0x28, 0xB5, 0x2F, 0xFD};
+    static constexpr unsigned char skippable_magic[3] = {0x2A, 0x4D, 0x18};
+    std::size_t size = (std::min)(input_buf_.size(), sizeof(magic));
+    if (size == 0)
+      return false;
+
+    auto data = static_cast<const unsigned char*>(input_buf_.data().data());
+    bool skippable = (data[0] & 0xF0) == 0x50
+        && std::memcmp(data + 1, skippable_magic, size - 1) == 0;
+    if (!skippable && std::memcmp(data, magic, size) != 0) {
+      passthrough_ = true;
+    } else if (size < sizeof(magic)) {
+      return false;
+    }
+    detect_pending_ = false;
+    return true;
+  }
+
+  void set_raw_bypass(std::size_t min_size, double max_entropy) noexcept
+  {
+    raw_bypass_min_size_ = min_size;
+    raw_bypass_max_entropy_ = max_entropy;
+  }
+
+  /**
+   * @brief bypass_encoder - returns true if data should be sent in a raw frame
+   * because compressing it would not pay off
+   */
+  bool bypass_encoder(const void* data, std::size_t size) const noexcept
+  {
+    return raw_bypass_min_size_ != 0 && size >= raw_bypass_min_size_
+        && estimate_entropy(data, size) > raw_bypass_max_entropy_;
+  }
+
+  void set_write_some_limit(std::size_t max_input) noexcept
+  {
+    write_some_limit_ =
+        max_input != 0 ? max_input : (std::numeric_limits<size_t>::max)();
+  }
+
+  void set_write_pipeline(std::size_t chunk_size) noexcept
+  {
+    write_chunk_size_ = chunk_size;
+  }
+
+  /**
+   * @brief pipeline_write - returns true if a write of size bytes should be
+   * split into chunks
+   */
+  bool pipeline_write(std::size_t size) const noexcept
+  {
+    std::size_t chunk_size = write_chunk_size();
+    return chunk_size != 0 && size > chunk_size;
+  }
+
+  /**
+   * @brief write_chunk_size - returns input chunk size of pipelined writes
+   *
+   * Writes of a multithreaded encoder are always pipelined so output of the
+   * workers is sent while the rest of the input is passed in.
+   */
+  std::size_t write_chunk_size() const noexcept
+  {
+    if (write_chunk_size_ == 0 && workers_ != 0) {
+      return multithreaded_chunk_size;
+    }
+    return write_chunk_size_;
+  }
+
+  /**
+   * @brief encode_buf - returns the buffer the encoder writes to
+   */
+  io_buffer<Allocator>& encode_buf() noexcept
+  {
+    return pipeline_swapped_ ? pipeline_buf_ : write_buf_;
+  }
+
+  /**
+   * @brief send_buf - returns the buffer of the chunk that is being sent by a
+   * pipelined write
+   */
+  io_buffer<Allocator>& send_buf() noexcept
+  {
+    return pipeline_swapped_ ? write_buf_ : pipeline_buf_;
+  }
+
+  void cancel_flush_timer() noexcept
+  {
+    if (flush_timer_armed_) {
+      flush_timer_armed_ = false;
+      error_code ignored;
+      flush_timer_.cancel(ignored);
+    }
+  }
+
+  void cancel_idle_timer() noexcept
+  {
+    if (idle_timer_armed_) {
+      idle_timer_armed_ = false;
+      error_code ignored;
+      idle_timer_.cancel(ignored);
+    }
+  }
+
+  template<class Parameter>
+  static void store_parameter(std::vector<std::pair<Parameter, int>>& params,
+                              Parameter param,
+                              int value)
+  {
+    for (auto& p : params) {
+      if (p.first == param) {
+        p.second = value;
+        return;
+      }
+    }
+    params.emplace_back(param, value);
+  }
+
+  /**
+   * @brief cctx_parameter - returns the stored value of an encoder parameter,
+   * 0 if it was not set
+   */
+  int cctx_parameter(ZSTD_cParameter param) const noexcept
+  {
+    for (const auto& p : cctx_params_) {
+      if (p.first == param)
+        return p.second;
+    }
+    return 0;
+  }
+
+  /**
+   * @brief effective_level - returns the level zstd uses for a level
+   * parameter, 0 selects the default level
+   */
+  static int effective_level(int level) noexcept
+  {
+    return level == 0 ? ZSTD_defaultCLevel() : level;
+  }
+
+  /**
+   * @brief level_window_log - returns the window log zstd picks for a level
+   * of streaming compression
+   */
+  static int level_window_log(int level) noexcept
+  {
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+    return int(ZSTD_getCParams(level, 0, 0).windowLog);
+#else
+    // ZSTD_getCParams() is experimental, assume the largest window a level
+    // picks
+    (void)level;
+    return default_window_log_limit;
+#endif
+  }
+
+  // an encoder with workers refers to threads of this compressor or of a
+  // shared pool, so it cannot be used by another compressor
+  bool cctx_reusable() const noexcept
+  {
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+    if (thread_pool_)
+      return false;
+#endif
+    return workers_ == 0;
+  }
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  error_code set_thread_pool(const compression_thread_pool* pool) noexcept
+  {
+    if (cctx_) {
+      size_t status = ZSTD_CCtx_refThreadPool(
+          cctx_.get(), pool ? pool->native_handle() : nullptr);
+      if (ZSTD_isError(status)) {
+        return make_error_code(ZSTD_getErrorCode(status));
+      }
+    }
+
+    // the context refers to the new pool now, the old one may be released
+    if (pool) {
+      thread_pool_ = *pool;
+    } else {
+      thread_pool_.reset();
+    }
+    return error_code();
+  }
+
+  /**
+   * @brief estimate_cstream_size - returns size of an encoder context with
+   * the stored parameters and the level or a zstd error
+   */
+  size_t estimate_cstream_size(int level) const noexcept
+  {
+    std::unique_ptr<ZSTD_CCtx_params, size_t (*)(ZSTD_CCtx_params*)> params(
+        ZSTD_createCCtxParams(), &ZSTD_freeCCtxParams);
+    if (!params)
+      return size_t(-ZSTD_error_memory_allocation);
+
+    for (const auto& p : cctx_params_) {
+      size_t status =
+          ZSTD_CCtxParams_setParameter(params.get(), p.first, p.second);
+      if (ZSTD_isError(status))
+        return status;
+    }
+    size_t status = ZSTD_CCtxParams_setParameter(
+        params.get(), ZSTD_c_compressionLevel, level);
+    if (ZSTD_isError(status))
+      return status;
+    return ZSTD_estimateCStreamSize_usingCCtxParams(params.get());
+  }
+#endif
+
+  static std::size_t workspace_units(std::size_t bytes) noexcept
+  {
+    return (bytes + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+  }
+
+  static std::size_t workspace_bytes(
+      const zstd_workspace<Allocator>& workspace) noexcept
+  {
+    return workspace.size() * sizeof(std::max_align_t);
+  }
+
+  /** @brief default chunk size of pipelined writes in multithreaded mode */
+  static constexpr std::size_t multithreaded_chunk_size = 512 * 1024;
+
   int compression_level_;  ///< @brief compression level
-  zstd_cstream_uptr cctx_;  ///< @brief Compression context
-  zstd_dstream_uptr dctx_;  ///< @brief Decompression context
-  /** < @brief Timer used for storing queued read operations */
-  timer pending_read_;
-  /** @brief Timer used for storing queued write operations */
-  timer pending_write_;
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  /** @brief workers of cctx_, must outlive it */
+  std::optional<compression_thread_pool> thread_pool_;
+#endif
+  /** @brief allocator of zstd contexts, empty for std::allocator */
+  std::shared_ptr<zstd_memory<Allocator>> zstd_memory_;
+  /** @brief memory of static contexts, must outlive them */
+  zstd_workspace<Allocator> cctx_workspace_;
+  zstd_workspace<Allocator> dctx_workspace_;
+  /** @brief window log of static contexts, 0 if contexts are allocated */
+  int static_window_log_ = 0;
+  /** @brief highest level the static encoder workspace fits */
+  int static_level_ = 0;
+  /** @brief source of contexts shared with other compressors */
+  std::optional<context_pool> context_pool_;
+  /** @brief encoder parameters, applied when cctx_ is created */
+  std::vector<std::pair<ZSTD_cParameter, int>> cctx_params_;
+  /** @brief decoder parameters, applied when dctx_ is created */
+  std::vector<std::pair<ZSTD_dParameter, int>> dctx_params_;
+  /** @brief dictionary of new frames of the encoder */
+  std::optional<dictionary> cdict_;
+  /** @brief dictionary referenced by cctx_, must outlive the frame */
+  std::optional<dictionary> cdict_in_use_;
+  /** @brief dictionaries the decoder picks from by dictionary ID */
+  std::vector<dictionary> ddicts_;
+  /** @brief source of trained dictionaries, samples written data */
+  std::optional<dictionary_trainer> trainer_;
+  /** @brief trainer generation the encoder and the decoder follow */
+  std::size_t encoder_generation_ = 0;
+  std::size_t decoder_generation_ = 0;
+  /** @brief trained dictionary the peer announced, 0 if none */
+  unsigned trained_cdict_id_ = 0;
+  /** @brief IDs of the last two trained dictionaries added to ddicts_ */
+  unsigned trained_ddict_ids_[2] = {};
+  /** @brief dictionary referenced by dctx_, must outlive the frame */
+  std::optional<dictionary> ddict_in_use_;
+  /** @brief data is passed through without compression */
+  bool passthrough_ = false;
+  /** @brief the first read checks whether the peer compresses */
+  bool auto_detect_ = false;
+  /** @brief true until the first bytes of the peer are checked */
+  bool detect_pending_ = false;
+  /** @brief end of the data sent and received, kept for export_session() */
+  history_buffer sent_history_;
+  history_buffer received_history_;
+  /** @brief resumed history, referenced by zstd until the frame ends */
+  std::string encoder_prefix_;
+  std::string decoder_prefix_;
+  std::uint64_t encoder_prefix_hash_ = 0;
+  std::uint64_t decoder_prefix_hash_ = 0;
+  /** @brief the next frame of the encoder starts with the resumed history */
+  bool encoder_prefix_pending_ = false;
+  /** @brief the decoder waits for the marker of the resumed history */
+  bool decoder_prefix_pending_ = false;
+  /** @brief the marker was received, the next frame uses the history */
+  bool decoder_prefix_armed_ = false;
+  /** @brief Compression context, created by the first write */
+  zstd_cstream_uptr cctx_;
+  /** @brief Decompression context, created by the first read */
+  zstd_dstream_uptr dctx_;
+  /** @brief lock that serializes read operations */
+  operation_lock<queued_read> read_lock_;
+  /** @brief lock that serializes write operations */
+  operation_lock<queued_write> write_lock_;
+  /** @brief queued write operations encoded by the lock owner */
+  wait_queue<queued_write> write_batch_;
   /** @brief buffer for input data from next_layer */
-  asio::basic_streambuf<Allocator> input_buf_;
+  io_buffer<Allocator> input_buf_;
   /** @brief buffer for output data */
-  asio::basic_streambuf<Allocator> write_buf_;
+  io_buffer<Allocator> write_buf_;
+  /** @brief size of reads from next_layer */
+  read_size_controller read_size_;
+  /** @brief data decoded ahead of read operations */
+  io_buffer<Allocator> decoded_buf_;
+  /** @brief size of decoded_buf_, 0 disables decoding ahead */
+  std::size_t decode_ahead_size_ = 0;
+  /** @brief limits of data decoded from the peer */
+  decode_limits decode_limits_;
+  /** @brief remaining decode rate budget */
+  decode_budget decode_budget_;
+  /** @brief decoded bytes the next read may return above the ratio limit */
+  std::size_t decode_credit_ = 0;
+  /** @brief second output buffer of pipelined writes */
+  io_buffer<Allocator> pipeline_buf_;
+
+  /** @brief policy that decides when written data is flushed */
+  flush_policy flush_policy_;
+  /** @brief number of bytes passed to the encoder since the last flush */
+  size_t unflushed_bytes_ = 0;
+  /** @brief time when the oldest unflushed byte was passed to the encoder */
+  std::chrono::steady_clock::time_point unflushed_since_;
+  /** @brief timer used to flush data when flush_policy deadline expires */
+  timer flush_timer_;
+  bool flush_timer_armed_ = false;
+  /** @brief error of the deadline flush reported by the next write */
+  error_code flush_error_;
+  /** @brief timer that releases contexts of an idle connection */
+  timer idle_timer_;
+  bool idle_timer_armed_ = false;
+  /** @brief time without new operations before hibernation, 0 disables it */
+  std::chrono::steady_clock::duration idle_time_ {};
+  /** @brief number of operations started so far */
+  std::size_t activity_ = 0;
+  /** @brief value of activity_ when the idle timer was armed */
+  std::size_t idle_activity_ = 0;
+  /** @brief true while a read waits for data from next_layer */
+  bool read_pending_ = false;
+  /**
+   * @brief data of a read that may wait, copied to a pooled input_buf_ when
+   * it arrives so an idle read does not hold a chunk of the pool
+   */
+  static constexpr std::size_t idle_read_size = 256;
+  unsigned char idle_read_buf_[idle_read_size] = {};
+  /** @brief true if the decoder finished the last frame it started */
+  bool decoder_between_frames_ = true;
+  /** @brief lets deadline flush detect that the compressor was destroyed */
+  std::shared_ptr<void> lifetime_;
+  /** @brief memory recycled by asynchronous operations */
+  std::shared_ptr<handler_memory<Allocator>> handler_memory_;
+
+  /** @brief executor used for compression of large chunks, may be empty */
+  asio::any_io_executor compute_executor_;
+  /** @brief chunks smaller than this are processed on the I/O executor */
+  std::size_t compute_min_size_ = 0;
+
+  /** @brief true if the encoder started a frame that was not ended yet */
+  bool frame_open_ = false;
+  /** @brief compression level currently set in cctx_ */
+  int current_level_ = 0;
+  /** @brief value of ZSTD_c_nbWorkers set in cctx_ */
+  int workers_ = 0;
+  /** @brief picks the compression level in adaptive mode */
+  level_controller level_controller_;
+  /** @brief time when the current write to the next layer was started */
+  std::chrono::steady_clock::time_point send_started_;
+  /** @brief end the frame on the next flush to apply a new level */
+  bool end_frame_on_flush_ = false;
+  /** @brief smallest buffer checked by the raw bypass, 0 disables it */
+  std::size_t raw_bypass_min_size_ = 0;
+  /** @brief entropy in bits per byte above which data is sent raw */
+  double raw_bypass_max_entropy_ = 0;
+
+  /** @brief maximum number of bytes consumed by one async_write_some() */
+  std::size_t write_some_limit_ = (std::numeric_limits<size_t>::max)();
+  /** @brief input chunk size of pipelined writes, 0 disables pipelining */
+  std::size_t write_chunk_size_ = 0;
+  /** @brief true if pipeline_buf_ is the buffer the encoder writes to */
+  bool pipeline_swapped_ = false;
+  /** @brief true while a chunk of a pipelined write is being sent */
+  bool pipeline_sending_ = false;
+  /** @brief error of the last chunk sent by a pipelined write */
+  error_code pipeline_error_;
+  /** @brief pipelined write waiting until the previous chunk is sent */
+  queued_write* pipeline_waiting_ = nullptr;
 
   compressor_statistics stats_;
 };
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+#include "zstd_api.h"
+
+namespace asio_stream_compressor
+{
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+/**
+ * @brief The compression_thread_pool class holds zstd worker threads that are
+ * shared by compressors in multithreaded mode.
+ *
+ * Without a shared pool every compressor with ZSTD_c_nbWorkers starts its own
+ * threads, so a server with many connections ends up with many more threads
+ * than cores. The pool is a reference counted handle, compressors keep a copy
+ * so the threads live as long as any compressor uses them.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::compression_thread_pool pool(
+ *     std::thread::hardware_concurrency());
+ * sock.set_compression_workers(4, pool);
+ * @endcode
+ *
+ * zstd thread pools are experimental API, the class is only available with
+ * ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL, see zstd_api.h.
+ */
+class compression_thread_pool
+{
+public:
+  /**
+   * @brief compression_thread_pool - starts worker threads
+   * @param threads - number of threads in the pool
+   *
+   * @throws std::bad_alloc if the pool cannot be created
+   */
+  explicit compression_thread_pool(std::size_t threads)
+      : pool_(ZSTD_createThreadPool(threads), &ZSTD_freeThreadPool)
+  {
+    if (!pool_) {
+      throw std::bad_alloc();
+    }
+  }
+
+  /**
+   * @brief native_handle - returns zstd thread pool
+   */
+  ZSTD_threadPool* native_handle() const noexcept
+  {
+    return pool_.get();
+  }
+
+private:
+  std::shared_ptr<ZSTD_threadPool> pool_;
+};
+#endif
+
+}  // namespace asio_stream_compressor
@@ -27,6 +27,7 @@ public:
   {
     value_type tx_bytes_total = 0;
     value_type tx_bytes_compressed = 0;
+    value_type tx_bytes_raw = 0;
     value_type rx_bytes_total = 0;
     value_type rx_bytes_compressed = 0;
   };
@@ -41,6 +42,7 @@ public:
     value_slice slice;
     slice.tx_bytes_total = tx_bytes_total.exchange(0, RELAXED);
     slice.tx_bytes_compressed = tx_bytes_compressed.exchange(0, RELAXED);
+    slice.tx_bytes_raw = tx_bytes_raw.exchange(0, RELAXED);
     slice.rx_bytes_total = rx_bytes_total.exchange(0, RELAXED);
     slice.rx_bytes_compressed = rx_bytes_compressed.exchange(0, RELAXED);
     return slice;
@@ -56,6 +58,12 @@ public:
    * underlying stream (usually socket) through async_write_some()
    */
   stat_type tx_bytes_compressed = ATOMIC_VAR_INIT(0);
+  /**
+   * @brief tx_bytes_raw - number of bytes passed to the async_write_some()
+   * method that were sent without compression because they looked
+   * incompressible
+   */
+  stat_type tx_bytes_raw = ATOMIC_VAR_INIT(0);
   /**
    * @brief rx_bytes_total - total number of bytes written to the buffers that
    * were provided to the async_read_some() method.
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <utility>
+
+#include "defines.h"
+#include "handler_memory.h"
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief post_to_compute - runs the next step of the operation on the compute
+ * executor
+ *
+ * The I/O executor is kept busy until the operation is posted back with
+ * post_to_io(), so io_context::run() does not return while codec work is in
+ * progress.
+ */
+template<class IoExecutor, class Operation>
+void post_to_compute(const asio::any_io_executor& compute_ex,
+                     const IoExecutor& io_ex,
+                     Operation&& op)
+{
+  auto alloc = op.get_allocator();
+  asio::post(compute_ex,
+             bind_allocator(alloc,
+                            [work = asio::make_work_guard(io_ex),
+                             op = std::forward<Operation>(op)]() mutable
+                            { op(error_code()); }));
+}
+
+/**
+ * @brief post_to_io - continues the operation on its I/O executor
+ */
+template<class IoExecutor, class Operation>
+void post_to_io(const IoExecutor& io_ex, Operation&& op)
+{
+  auto alloc = op.get_allocator();
+  asio::post(io_ex,
+             bind_allocator(alloc,
+                            [op = std::forward<Operation>(op)]() mutable
+                            { op(error_code()); }));
+}
+
+/**
+ * @brief post_immediate - continues an operation that finished without
+ * waiting for the next layer
+ *
+ * The handler must not be invoked from the initiating function. The operation
+ * goes through the immediate executor of the handler where asio provides one,
+ * otherwise it is posted to the I/O executor.
+ */
+template<class Handler, class IoExecutor, class Operation>
+void post_immediate(const Handler& handler,
+                    const IoExecutor& io_ex,
+                    Operation&& op)
+{
+#ifdef ASIO_STREAM_COMPRESSOR_HAS_IMMEDIATE_EXECUTOR
+  // the executor is obtained before the handler is moved with the operation
+  auto ex = asio::get_associated_immediate_executor(handler, io_ex);
+  auto alloc = op.get_allocator();
+  asio::dispatch(ex,
+                 bind_allocator(alloc,
+                                [op = std::forward<Operation>(op)]() mutable
+                                { op(error_code()); }));
+#else
+  (void)handler;
+  post_to_io(io_ex, std::forward<Operation>(op));
+#endif
+}
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "zstd_api.h"
+#include "zstd_memory.h"
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The context_pool class keeps zstd contexts released by compressors
+ * for the next compressors that need them.
+ *
+ * Compressors that use a pool take a context when their first read or write
+ * needs it and give it back on reset() or destruction. A context keeps its
+ * workspace when it goes back to the pool, so a storm of short connections
+ * does not allocate and initialize encoder tables for every connection.
+ *
+ * The pool is split into shards selected by the calling thread, so threads
+ * of a server do not contend for one lock. Copies of a pool share the cached
+ * contexts, and a compressor keeps its own copy, so the pool may be
+ * destroyed before the compressors that give contexts back to it.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::context_pool pool;
+ * for (auto& sock : connections) {
+ *   sock.set_context_pool(pool);
+ * }
+ * @endcode
+ */
+class context_pool
+{
+public:
+  /**
+   * @brief context_pool - creates an empty pool
+   * @param max_cached - number of contexts of each kind a shard keeps, more
+   * released contexts are freed
+   * @param shards - number of shards, 0 means one per hardware thread
+   */
+  explicit context_pool(std::size_t max_cached = 64, std::size_t shards = 0)
+      : impl_(std::make_shared<impl>(max_cached, shards))
+  {
+  }
+
+  /**
+   * @brief acquire_cctx - returns a cached encoder context or creates one.
+   * Used by compressors.
+   */
+  detail::zstd_cstream_uptr acquire_cctx() const
+  {
+    impl::shard& s = impl_->local_shard();
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (!s.cctx.empty()) {
+        ZSTD_CCtx* ctx = s.cctx.back();
+        s.cctx.pop_back();
+        return detail::zstd_cstream_uptr(ctx);
+      }
+    }
+    return detail::zstd_cstream_uptr(ZSTD_createCCtx());
+  }
+
+  /**
+   * @brief acquire_dctx - returns a cached decoder context or creates one.
+   * Used by compressors.
+   */
+  detail::zstd_dstream_uptr acquire_dctx() const
+  {
+    impl::shard& s = impl_->local_shard();
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (!s.dctx.empty()) {
+        ZSTD_DCtx* ctx = s.dctx.back();
+        s.dctx.pop_back();
+        return detail::zstd_dstream_uptr(ctx);
+      }
+    }
+    return detail::zstd_dstream_uptr(ZSTD_createDCtx());
+  }
+
+  /**
+   * @brief release - resets the context and keeps it for reuse
+   */
+  void release(detail::zstd_cstream_uptr ctx) const noexcept
+  {
+    ZSTD_CCtx_reset(ctx.get(), ZSTD_reset_session_and_parameters);
+    impl::shard& s = impl_->local_shard();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.cctx.size() < impl_->max_cached) {
+      s.cctx.push_back(ctx.release());
+    }
+  }
+
+  /**
+   * @brief release - resets the context and keeps it for reuse
+   */
+  void release(detail::zstd_dstream_uptr ctx) const noexcept
+  {
+    ZSTD_DCtx_reset(ctx.get(), ZSTD_reset_session_and_parameters);
+    impl::shard& s = impl_->local_shard();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.dctx.size() < impl_->max_cached) {
+      s.dctx.push_back(ctx.release());
+    }
+  }
+
+  /**
+   * @brief cached_contexts - returns number of contexts kept by the pool
+   */
+  std::size_t cached_contexts() const
+  {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < impl_->shard_count; ++i) {
+      impl::shard& s = impl_->shards[i];
+      std::lock_guard<std::mutex> lock(s.mutex);
+      count += s.cctx.size() + s.dctx.size();
+    }
+    return count;
+  }
+
+private:
+  struct impl
+  {
+    struct shard
+    {
+      std::mutex mutex;
+      std::vector<ZSTD_CCtx*> cctx;
+      std::vector<ZSTD_DCtx*> dctx;
+    };
+
+    impl(std::size_t cache_size, std::size_t shard_hint)
+        : max_cached(cache_size)
+        , shard_count(shard_hint != 0 ? shard_hint
+                                      : std::thread::hardware_concurrency())
+    {
+      if (shard_count == 0)
+        shard_count = 1;
+      shards.reset(new shard[shard_count]);
+      // release() must not allocate under the lock
+      for (std::size_t i = 0; i < shard_count; ++i) {
+        shards[i].cctx.reserve(max_cached);
+        shards[i].dctx.reserve(max_cached);
+      }
+    }
+
+    ~impl()
+    {
+      for (std::size_t i = 0; i < shard_count; ++i) {
+        for (ZSTD_CCtx* ctx : shards[i].cctx) {
+          ZSTD_freeCCtx(ctx);
+        }
+        for (ZSTD_DCtx* ctx : shards[i].dctx) {
+          ZSTD_freeDCtx(ctx);
+        }
+      }
+    }
+
+    shard& local_shard() noexcept
+    {
+      static thread_local const std::size_t hash =
+          std::hash<std::thread::id>()(std::this_thread::get_id());
+      return shards[hash % shard_count];
+    }
+
+    std::size_t max_cached;
+    std::size_t shard_count;
+    std::unique_ptr<shard[]> shards;
+  };
+
+  std::shared_ptr<impl> impl_;
+};
+
+}  // namespace asio_stream_compressor
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The decode_limits class bounds the work a peer can make the decoder
+ * do.
+ *
+ * A frame may declare a window of up to 2 GiB and a small input may expand
+ * to gigabytes, so a compressor that reads from untrusted peers should set
+ * limits. A read that exceeds a limit fails with a decode_limit_error and
+ * the compressor has to be reset() or closed.
+ *
+ * Example:
+ * @code
+ * sock.set_decode_limits(asio_stream_compressor::decode_limits()
+ *                            .max_window_log(20)
+ *                            .max_ratio(100)
+ *                            .max_rate(64 * 1024 * 1024));
+ * @endcode
+ */
+class decode_limits
+{
+public:
+  /**
+   * @brief max_window_log - sets the largest window a frame may declare,
+   * 0 keeps the zstd default of 2^27 bytes
+   */
+  decode_limits& max_window_log(int window_log) noexcept
+  {
+    max_window_log_ = window_log;
+    return *this;
+  }
+
+  int max_window_log() const noexcept
+  {
+    return max_window_log_;
+  }
+
+  /**
+   * @brief max_ratio - sets the largest number of decoded bytes per
+   * compressed byte a read may return, 0 disables the limit
+   *
+   * The decoder may return a block in the read after the one that received
+   * it, so the unused part of the limit, up to ZSTD_BLOCKSIZE_MAX bytes, is
+   * carried over to the next read.
+   */
+  decode_limits& max_ratio(std::size_t ratio) noexcept
+  {
+    max_ratio_ = ratio;
+    return *this;
+  }
+
+  std::size_t max_ratio() const noexcept
+  {
+    return max_ratio_;
+  }
+
+  /**
+   * @brief max_rate - sets the number of bytes per second the decoder may
+   * produce, 0 disables the limit
+   *
+   * Bursts of up to one second worth of data are allowed.
+   */
+  decode_limits& max_rate(std::size_t bytes_per_second) noexcept
+  {
+    max_rate_ = bytes_per_second;
+    return *this;
+  }
+
+  std::size_t max_rate() const noexcept
+  {
+    return max_rate_;
+  }
+
+private:
+  int max_window_log_ = 0;
+  std::size_t max_ratio_ = 0;
+  std::size_t max_rate_ = 0;
+};
+
+namespace detail
+{
+/**
+ * @brief The decode_budget class is a token bucket that enforces the decode
+ * rate limit.
+ */
+class decode_budget
+{
+public:
+  void reset(std::size_t rate) noexcept
+  {
+    rate_ = rate;
+    tokens_ = static_cast<double>(rate);
+    last_ = std::chrono::steady_clock::now();
+  }
+
+  bool enabled() const noexcept
+  {
+    return rate_ != 0;
+  }
+
+  /**
+   * @brief consume - takes bytes from the budget
+   * @return false if the budget is exceeded
+   */
+  bool consume(std::size_t bytes) noexcept
+  {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - last_;
+    last_ = now;
+    double rate = static_cast<double>(rate_);
+    tokens_ += elapsed.count() * rate;
+    if (tokens_ > rate) {
+      tokens_ = rate;
+    }
+    tokens_ -= static_cast<double>(bytes);
+    return tokens_ >= 0;
+  }
+
+private:
+  std::size_t rate_ = 0;
+  double tokens_ = 0;
+  std::chrono::steady_clock::time_point last_;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
@@ -2,12 +2,25 @@
 
 #ifdef ASIO_STEREAM_COMPRESSOR_FLAVOUR_STANDALONE
 
+#include <chrono>
 #include <system_error>
 
+#include <asio/any_io_executor.hpp>
+#include <asio/associated_allocator.hpp>
+#include <asio/bind_executor.hpp>
+#include <asio/executor_work_guard.hpp>
+#include <asio/post.hpp>
 #include <asio/steady_timer.hpp>
 #include <asio/streambuf.hpp>
+#include <asio/version.hpp>
 #include <asio/write.hpp>
 
+#if ASIO_VERSION >= 102800
+#include <asio/associated_immediate_executor.hpp>
+#include <asio/dispatch.hpp>
+#define ASIO_STREAM_COMPRESSOR_HAS_IMMEDIATE_EXECUTOR
+#endif
+
 // namespace fwd
 namespace asio
 {
@@ -29,30 +42,35 @@ const error_category& system_category()
   return std::system_category();
 }
 
-inline timer::time_point neg_infin()
-{
-  return (timer::time_point::min)();
-}
-
-inline timer::time_point pos_infin()
+inline void expires_after(timer& timer,
+                          std::chrono::steady_clock::duration duration)
 {
-  return (timer::time_point::max)();
-}
-
-inline timer::time_point expiry(const timer& timer)
-{
-  return timer.expiry();
+  timer.expires_after(duration);
 }
 
 }  // namespace asio_stream_compressor
 
 #else
 
+#include <chrono>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/streambuf.hpp>
+#include <boost/asio/version.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/system/error_code.hpp>
 
+#if BOOST_ASIO_VERSION >= 102800
+#include <boost/asio/associated_immediate_executor.hpp>
+#include <boost/asio/dispatch.hpp>
+#define ASIO_STREAM_COMPRESSOR_HAS_IMMEDIATE_EXECUTOR
+#endif
+
 // namespace fwd
 namespace boost
 {
@@ -80,20 +98,11 @@ inline const error_category& system_category()
 namespace detail
 {
 
-inline boost::asio::deadline_timer::time_type neg_infin()
-{
-  return boost::posix_time::neg_infin;
-}
-
-inline boost::asio::deadline_timer::time_type pos_infin()
-{
-  return boost::posix_time::pos_infin;
-}
-
-inline boost::asio::deadline_timer::time_type expiry(
-    const boost::asio::deadline_timer& timer)
+inline void expires_after(boost::asio::deadline_timer& timer,
+                          std::chrono::steady_clock::duration duration)
 {
-  return timer.expires_at();
+  timer.expires_from_now(boost::posix_time::microseconds(
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
 }
 
 }  // namespace detail
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "zstd_api.h"
+#include "zstd_error_condition.h"
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The dictionary class holds a zstd dictionary digested for the
+ * encoder and the decoder.
+ *
+ * Digesting a dictionary builds the tables zstd would otherwise build at the
+ * start of every frame, so it is done once and the result is shared by all
+ * compressors that use the dictionary. Compressors only refer to the
+ * digested dictionary, which is never modified. Copying a dictionary does
+ * not copy the tables, the digested dictionary is freed with the last copy.
+ *
+ * The decoder picks the dictionary by the ID the encoder writes to every
+ * frame, so dictionaries must have an ID. Dictionaries made by zstd --train
+ * or ZDICT_trainFromBuffer() have one.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::dictionary dict(data.data(), data.size());
+ * for (auto& sock : connections) {
+ *   sock.set_encoder_dictionary(dict);
+ *   sock.add_decoder_dictionary(dict);
+ * }
+ * @endcode
+ */
+class dictionary
+{
+public:
+  /**
+   * @brief dictionary - digests a zstd dictionary
+   * @param data - content of the dictionary, copied
+   * @param size - size of the dictionary
+   * @param level - compression level of frames that use the dictionary
+   * @throws system_error with ZSTD_error_dictionary_wrong if the dictionary
+   * has no ID and ZSTD_error_dictionary_corrupted if zstd cannot load it
+   */
+  dictionary(const void* data,
+             std::size_t size,
+             int level = ZSTD_CLEVEL_DEFAULT) noexcept(false)
+      : impl_(std::make_shared<impl>())
+  {
+    impl_->id = ZSTD_getDictID_fromDict(data, size);
+    if (impl_->id == 0) {
+      throw system_error(make_error_code(ZSTD_error_dictionary_wrong));
+    }
+
+    impl_->cdict = ZSTD_createCDict(data, size, level);
+    impl_->ddict = ZSTD_createDDict(data, size);
+    if (!impl_->cdict || !impl_->ddict) {
+      throw system_error(make_error_code(ZSTD_error_dictionary_corrupted));
+    }
+  }
+
+  /**
+   * @brief id - returns ID of the dictionary written to frames that use it
+   */
+  unsigned id() const noexcept
+  {
+    return impl_->id;
+  }
+
+  /**
+   * @brief native_cdict - returns the dictionary digested for the encoder
+   */
+  const ZSTD_CDict* native_cdict() const noexcept
+  {
+    return impl_->cdict;
+  }
+
+  /**
+   * @brief native_ddict - returns the dictionary digested for the decoder
+   */
+  const ZSTD_DDict* native_ddict() const noexcept
+  {
+    return impl_->ddict;
+  }
+
+  bool operator==(const dictionary& o) const noexcept
+  {
+    return impl_ == o.impl_;
+  }
+
+  bool operator!=(const dictionary& o) const noexcept
+  {
+    return impl_ != o.impl_;
+  }
+
+private:
+  struct impl
+  {
+    impl() = default;
+    impl(const impl&) = delete;
+    impl& operator=(const impl&) = delete;
+
+    ~impl()
+    {
+      ZSTD_freeCDict(cdict);
+      ZSTD_freeDDict(ddict);
+    }
+
+    unsigned id = 0;
+    ZSTD_CDict* cdict = nullptr;
+    ZSTD_DDict* ddict = nullptr;
+  };
+
+  std::shared_ptr<impl> impl_;
+};
+
+}  // namespace asio_stream_compressor
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "defines.h"
+#include "dictionary.h"
+#include "zstd_api.h"
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The dictionary_trainer class builds dictionaries from data written
+ * by compressors and publishes them to these compressors.
+ *
+ * Compressors that use a trainer give it the beginning of every buffer
+ * passed to async_write_some() as a sample. When enough samples are
+ * collected, training runs on the executor of the trainer, so I/O threads
+ * only copy the samples. Training uses
+ * ZDICT_optimizeTrainFromBuffer_fastCover() tuned for the level with
+ * ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL and ZDICT_trainFromBuffer()
+ * without it. A writer never waits for the trainer, samples that would wait are
+ * dropped. After a dictionary is published, sampling pauses for the
+ * interval.
+ *
+ * Decoders of the compressors accept the two last published dictionaries.
+ * An encoder keeps its dictionary until the peer announced the published
+ * one and compressor::use_trained_dictionary() is called with its ID, so a
+ * peer in another process first needs the content from the publish
+ * handler. Copies of a trainer collect samples into the same
+ * training. Compressors and a training in progress keep copies, so the
+ * trainer lives on until the last of them is gone.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::dictionary_trainer trainer(pool.get_executor());
+ * trainer.set_publish_handler(
+ *     [](const asio_stream_compressor::dictionary& dict,
+ *        const void* data,
+ *        std::size_t size) { send_to_peers(dict.id(), data, size); });
+ * for (auto& sock : connections) {
+ *   sock.set_dictionary_trainer(trainer);
+ * }
+ * // when a peer acknowledged the dictionary
+ * sock.use_trained_dictionary(id);
+ * @endcode
+ */
+class dictionary_trainer
+{
+public:
+  /**
+   * @brief publish_handler - called on the executor of the trainer with a
+   * new dictionary and its content before compressors can use it
+   */
+  using publish_handler =
+      std::function<void(const dictionary&, const void*, std::size_t)>;
+
+  /** @brief largest part of a buffer taken as a sample */
+  static constexpr std::size_t max_sample_size = 8 * 1024;
+  /** @brief smaller buffers are not sampled */
+  static constexpr std::size_t min_sample_size = 16;
+
+  /**
+   * @brief dictionary_trainer - creates a trainer without a dictionary
+   * @param ex - executor that runs the training, it should not be an I/O
+   * executor
+   * @param dict_size - size of trained dictionaries
+   * @param sample_size - number of sampled bytes one dictionary is trained on
+   * @param interval - time after a training before sampling starts again
+   * @param level - compression level of frames that use the dictionaries
+   */
+  explicit dictionary_trainer(
+      const asio::any_io_executor& ex,
+      std::size_t dict_size = 16 * 1024,
+      std::size_t sample_size = 1024 * 1024,
+      std::chrono::steady_clock::duration interval = std::chrono::minutes(1),
+      int level = ZSTD_CLEVEL_DEFAULT)
+      : impl_(std::make_shared<impl>(
+            ex, dict_size, sample_size, interval, level))
+  {
+  }
+
+  /**
+   * @brief set_publish_handler - sets the function called with every new
+   * dictionary
+   *
+   * @warning Call this function before the first sample is added.
+   */
+  void set_publish_handler(publish_handler handler)
+  {
+    impl_->handler = std::move(handler);
+  }
+
+  /**
+   * @brief add_sample - copies the beginning of the buffers to the samples.
+   * Used by compressors.
+   */
+  template<class ConstBufferSequence>
+  void add_sample(const ConstBufferSequence& buffers) const
+  {
+    std::size_t size = (std::min)(asio::buffer_size(buffers), max_sample_size);
+    if (size < min_sample_size)
+      return;
+
+    impl& d = *impl_;
+    std::unique_lock<std::mutex> lock(d.mutex, std::try_to_lock);
+    if (!lock.owns_lock() || d.training)
+      return;
+    if (d.samples.empty()
+        && std::chrono::steady_clock::now() < d.next_sampling)
+    {
+      return;
+    }
+
+    std::size_t offset = d.samples.size();
+    try {
+      d.samples.resize(offset + size);
+      d.sizes.push_back(size);
+    } catch (const std::bad_alloc&) {
+      d.samples.resize(offset);
+      return;
+    }
+    asio::buffer_copy(asio::buffer(&d.samples[offset], size), buffers);
+    if (d.samples.size() < d.sample_size)
+      return;
+
+    // samples are not modified until the training is finished
+    d.training = true;
+    lock.unlock();
+    asio::post(d.executor, [d = impl_]() { d->train(); });
+  }
+
+  /**
+   * @brief generation - returns number of dictionaries published so far
+   */
+  std::size_t generation() const noexcept
+  {
+    return impl_->generation.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief get_dictionary - returns the last published dictionary
+   */
+  std::optional<dictionary> get_dictionary() const
+  {
+    std::lock_guard<std::mutex> lock(impl_->dict_mutex);
+    return impl_->dict;
+  }
+
+private:
+  struct impl
+  {
+    impl(const asio::any_io_executor& ex,
+         std::size_t dict_bytes,
+         std::size_t sample_bytes,
+         std::chrono::steady_clock::duration pause,
+         int dict_level)
+        : executor(ex)
+        , dict_size(dict_bytes)
+        , sample_size(sample_bytes)
+        , interval(pause)
+        , level(dict_level)
+    {
+    }
+
+    void train()
+    {
+      std::vector<char> content(dict_size);
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+      ZDICT_fastCover_params_t params {};
+      // the parameters ZDICT_trainFromBuffer() uses
+      params.d = 8;
+      params.steps = 4;
+      params.nbThreads = 1;
+      params.zParams.compressionLevel = level;
+      size_t size =
+          ZDICT_optimizeTrainFromBuffer_fastCover(content.data(),
+                                                  content.size(),
+                                                  samples.data(),
+                                                  sizes.data(),
+                                                  unsigned(sizes.size()),
+                                                  &params);
+#else
+      // the dictionary is tuned for the default level
+      size_t size = ZDICT_trainFromBuffer(content.data(),
+                                          content.size(),
+                                          samples.data(),
+                                          sizes.data(),
+                                          unsigned(sizes.size()));
+#endif
+      std::optional<dictionary> trained;
+      if (!ZDICT_isError(size)) {
+        try {
+          trained.emplace(content.data(), size, level);
+        } catch (const system_error&) {
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string().swap(samples);
+        std::vector<size_t>().swap(sizes);
+        training = false;
+        if (trained) {
+          next_sampling = std::chrono::steady_clock::now() + interval;
+        }
+      }
+      if (!trained)
+        return;
+
+      if (handler) {
+        handler(*trained, content.data(), size);
+      }
+      {
+        std::lock_guard<std::mutex> lock(dict_mutex);
+        dict = std::move(trained);
+      }
+      generation.fetch_add(1, std::memory_order_release);
+    }
+
+    asio::any_io_executor executor;
+    std::size_t dict_size;
+    std::size_t sample_size;
+    std::chrono::steady_clock::duration interval;
+    int level;
+    publish_handler handler;
+
+    /** @brief guards the samples */
+    std::mutex mutex;
+    std::string samples;
+    std::vector<size_t> sizes;
+    /** @brief true while the samples are used by the training */
+    bool training = false;
+    std::chrono::steady_clock::time_point next_sampling;
+
+    std::mutex dict_mutex;
+    std::optional<dictionary> dict;
+    std::atomic<std::size_t> generation {0};
+  };
+
+  std::shared_ptr<impl> impl_;
+};
+
+}  // namespace asio_stream_compressor
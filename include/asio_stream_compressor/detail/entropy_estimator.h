@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief estimate_entropy - estimates entropy of data in bits per byte
+ * @param data - data to check
+ * @param size - size of data
+ *
+ * The estimate is built from a byte histogram of evenly spaced samples, so
+ * its cost does not depend on size. Compressed or encrypted data is close to
+ * 8 bits per byte, text is usually below 6. Repeated sequences of random
+ * bytes are not detected.
+ */
+inline double estimate_entropy(const void* data, std::size_t size) noexcept
+{
+  constexpr std::size_t sample_count = 16;
+  constexpr std::size_t sample_size = 256;
+
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  std::size_t count = size;
+  std::size_t stride = sample_size;
+  if (size > sample_count * sample_size) {
+    count = sample_count * sample_size;
+    stride = size / sample_count;
+  }
+
+  // separate tables avoid a dependency between consecutive increments of the
+  // same counter and let the compiler unroll the loop
+  std::uint32_t histogram[4][256] = {};
+  for (std::size_t offset = 0; offset < count; offset += sample_size) {
+    const unsigned char* sample = bytes + offset / sample_size * stride;
+    std::size_t n = count - offset < sample_size ? count - offset : sample_size;
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      ++histogram[0][sample[i]];
+      ++histogram[1][sample[i + 1]];
+      ++histogram[2][sample[i + 2]];
+      ++histogram[3][sample[i + 3]];
+    }
+    for (; i < n; ++i) {
+      ++histogram[0][sample[i]];
+    }
+  }
+
+  if (count == 0)
+    return 0;
+
+  double sum = 0;
+  for (std::size_t b = 0; b < 256; ++b) {
+    std::size_t c = std::size_t(histogram[0][b]) + histogram[1][b]
+        + histogram[2][b] + histogram[3][b];
+    if (c != 0) {
+      double n = static_cast<double>(c);
+      sum += n * std::log2(n);
+    }
+  }
+  double total = static_cast<double>(count);
+  return std::log2(total) - sum / total;
+}
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
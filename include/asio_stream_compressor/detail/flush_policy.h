@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <limits>
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The flush_policy class controls when async_write_some() forces the
+ * encoder to emit all buffered data to the next layer.
+ *
+ * Every flush closes the current zstd block, so flushing after each small
+ * write costs additional bytes and a separate write to the next layer. A
+ * relaxed policy lets several writes share one block. Data that was not
+ * flushed yet stays inside the encoder and can be forced out with
+ * compressor::async_flush().
+ *
+ * Example:
+ * @code
+ * // flush when 16 KiB were written or 5 ms after the first unflushed byte
+ * sock.set_flush_policy(asio_stream_compressor::flush_policy::threshold(
+ *     16 * 1024, std::chrono::milliseconds(5)));
+ * @endcode
+ */
+class flush_policy
+{
+public:
+  using duration = std::chrono::steady_clock::duration;
+
+  /**
+   * @brief always - flush after every write. This is the default policy.
+   */
+  static flush_policy always() noexcept
+  {
+    return flush_policy(0, (duration::max)());
+  }
+
+  /**
+   * @brief threshold - flush when at least bytes were written since the last
+   * flush
+   * @param bytes - number of uncompressed bytes that triggers a flush
+   * @param max_delay - maximum time data is allowed to stay unflushed
+   */
+  static flush_policy threshold(
+      std::size_t bytes, duration max_delay = (duration::max)()) noexcept
+  {
+    return flush_policy(bytes, max_delay);
+  }
+
+  /**
+   * @brief deadline - flush when max_delay elapsed since the first unflushed
+   * byte was written
+   * @param max_delay - maximum time data is allowed to stay unflushed
+   */
+  static flush_policy deadline(duration max_delay) noexcept
+  {
+    return flush_policy((std::numeric_limits<std::size_t>::max)(), max_delay);
+  }
+
+  /**
+   * @brief manual - never flush implicitly. Data is sent only when the
+   * encoder fills a whole block or when async_flush() is called.
+   */
+  static flush_policy manual() noexcept
+  {
+    return flush_policy((std::numeric_limits<std::size_t>::max)(),
+                        (duration::max)());
+  }
+
+  /**
+   * @brief max_pending_bytes - number of unflushed bytes that triggers a
+   * flush
+   */
+  std::size_t max_pending_bytes() const noexcept
+  {
+    return max_pending_bytes_;
+  }
+
+  /**
+   * @brief max_delay - maximum time data is allowed to stay unflushed
+   *
+   * duration::max() means there is no deadline.
+   */
+  duration max_delay() const noexcept
+  {
+    return max_delay_;
+  }
+
+  /**
+   * @brief has_deadline - returns true if unflushed data is flushed by a timer
+   */
+  bool has_deadline() const noexcept
+  {
+    return max_delay_ != (duration::max)();
+  }
+
+private:
+  flush_policy(std::size_t max_pending_bytes, duration max_delay) noexcept
+      : max_pending_bytes_(max_pending_bytes)
+      , max_delay_(max_delay)
+  {
+  }
+
+  std::size_t max_pending_bytes_;
+  duration max_delay_;
+};
+
+}  // namespace asio_stream_compressor
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The handler_memory class keeps a few blocks of memory released by
+ * asynchronous operations of one compressor for the next operation.
+ *
+ * A read and a write hop between the next layer, the flush timer and the
+ * executors with objects of almost the same size every time, so after the
+ * first operations every allocation is served from the cache. Slots are
+ * exchanged atomically because a step running on the compute executor may
+ * release memory while the I/O thread allocates.
+ */
+template<class Allocator>
+class handler_memory
+{
+public:
+  /** @brief number of cached blocks */
+  static constexpr std::size_t cache_size = 8;
+
+  explicit handler_memory(const Allocator& alloc) noexcept
+      : alloc_(alloc)
+  {
+  }
+
+  handler_memory(const handler_memory&) = delete;
+  handler_memory& operator=(const handler_memory&) = delete;
+
+  ~handler_memory()
+  {
+    for (auto& slot : cache_) {
+      if (block* b = slot.load(std::memory_order_relaxed)) {
+        free_block(b);
+      }
+    }
+  }
+
+  void* allocate(std::size_t size)
+  {
+    for (auto& slot : cache_) {
+      block* b = slot.exchange(nullptr, std::memory_order_acquire);
+      if (!b)
+        continue;
+      if (b->size >= size)
+        return b + 1;
+      // keep the small block for smaller objects
+      put(b);
+    }
+
+    // round up so that objects of similar size share blocks
+    std::size_t units = (size + sizeof(block) - 1) / sizeof(block);
+    units = (units + 3) & ~std::size_t(3);
+    block* b = block_allocator(alloc_).allocate(units + 1);
+    b->size = units * sizeof(block);
+    return b + 1;
+  }
+
+  void deallocate(void* ptr) noexcept
+  {
+    put(static_cast<block*>(ptr) - 1);
+  }
+
+private:
+  struct alignas(std::max_align_t) block
+  {
+    std::size_t size;
+  };
+
+  using block_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<block>;
+
+  void put(block* b) noexcept
+  {
+    for (auto& slot : cache_) {
+      block* expected = nullptr;
+      if (slot.compare_exchange_strong(
+              expected, b, std::memory_order_release, std::memory_order_relaxed))
+      {
+        return;
+      }
+    }
+    free_block(b);
+  }
+
+  void free_block(block* b) noexcept
+  {
+    block_allocator(alloc_).deallocate(b, b->size / sizeof(block) + 1);
+  }
+
+  Allocator alloc_;
+  std::atomic<block*> cache_[cache_size] = {};
+};
+
+/**
+ * @brief The handler_allocator class is the allocator of operations whose
+ * completion handler has no associated allocator. It takes memory from the
+ * handler_memory of the compressor and keeps it alive until the last
+ * operation is destroyed.
+ */
+template<class T, class Allocator>
+class handler_allocator
+{
+public:
+  using value_type = T;
+
+  template<class U>
+  struct rebind
+  {
+    using other = handler_allocator<U, Allocator>;
+  };
+
+  explicit handler_allocator(
+      std::shared_ptr<handler_memory<Allocator>> memory) noexcept
+      : memory_(std::move(memory))
+  {
+  }
+
+  template<class U>
+  handler_allocator(const handler_allocator<U, Allocator>& o) noexcept
+      : memory_(o.memory_)
+  {
+  }
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T* ptr, std::size_t) noexcept
+  {
+    memory_->deallocate(ptr);
+  }
+
+  template<class U>
+  bool operator==(const handler_allocator<U, Allocator>& o) const noexcept
+  {
+    return memory_ == o.memory_;
+  }
+
+  template<class U>
+  bool operator!=(const handler_allocator<U, Allocator>& o) const noexcept
+  {
+    return memory_ != o.memory_;
+  }
+
+private:
+  template<class U, class A>
+  friend class handler_allocator;
+
+  std::shared_ptr<handler_memory<Allocator>> memory_;
+};
+
+/**
+ * @brief The allocator_binder class is a function object with an associated
+ * allocator, so posting it uses the memory of the operation.
+ */
+template<class Function, class Alloc>
+class allocator_binder
+{
+public:
+  using allocator_type = Alloc;
+
+  allocator_binder(const Alloc& alloc, Function&& function)
+      : alloc_(alloc)
+      , function_(std::move(function))
+  {
+  }
+
+  allocator_type get_allocator() const noexcept
+  {
+    return alloc_;
+  }
+
+  void operator()()
+  {
+    function_();
+  }
+
+private:
+  Alloc alloc_;
+  Function function_;
+};
+
+template<class Alloc, class Function>
+allocator_binder<std::decay_t<Function>, Alloc> bind_allocator(
+    const Alloc& alloc, Function&& function)
+{
+  return {alloc, std::forward<Function>(function)};
+}
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "zstd_error_condition.h"
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The handshake_options class describes what a compressor asks of
+ * its peer in async_handshake().
+ *
+ * The window the decoder accepts and the dictionaries it knows are taken
+ * from the compressor, these options add the preferences that only matter
+ * to the peer.
+ *
+ * Example:
+ * @code
+ * sock.async_handshake(asio_stream_compressor::handshake_options()
+ *                          .preferred_level(1),
+ *                      [](error_code ec) {});
+ * @endcode
+ */
+class handshake_options
+{
+public:
+  /**
+   * @brief preferred_level - sets the compression level the peer should use
+   * for data sent to this compressor, 0 leaves the choice to the peer
+   */
+  handshake_options& preferred_level(int level) noexcept
+  {
+    preferred_level_ = level;
+    return *this;
+  }
+
+  int preferred_level() const noexcept
+  {
+    return preferred_level_;
+  }
+
+  /**
+   * @brief max_level - sets the highest level the peer may ask this
+   * compressor to use, 0 caps it at the level the compressor already uses
+   */
+  handshake_options& max_level(int level) noexcept
+  {
+    max_level_ = level;
+    return *this;
+  }
+
+  int max_level() const noexcept
+  {
+    return max_level_;
+  }
+
+  /**
+   * @brief compression - false asks for a connection without compression,
+   * both peers then pass data through as is
+   */
+  handshake_options& compression(bool enabled) noexcept
+  {
+    compression_ = enabled;
+    return *this;
+  }
+
+  bool compression() const noexcept
+  {
+    return compression_;
+  }
+
+private:
+  int preferred_level_ = 0;
+  int max_level_ = 0;
+  bool compression_ = true;
+};
+
+namespace detail
+{
+/**
+ * @brief The handshake_record struct is the capability record exchanged by
+ * async_handshake().
+ *
+ * Layout, integers are little endian:
+ * - 4 bytes magic, not a valid zstd frame magic
+ * - 1 byte version
+ * - 1 byte flags, bit 0 asks for a connection without compression
+ * - 1 byte largest window log the decoder accepts
+ * - 1 byte number of dictionary IDs
+ * - 4 bytes preferred compression level, signed
+ * - 8 bytes hash of the resumed history the encoder primes with, 0 if none
+ * - 8 bytes hash of the resumed history the decoder primes with, 0 if none
+ * - 4 bytes per dictionary ID the decoder knows
+ */
+struct handshake_record
+{
+  static constexpr unsigned char magic[4] = {'Z', 'S', 'H', 'K'};
+  static constexpr unsigned char version = 2;
+  static constexpr std::size_t header_size = 28;
+  static constexpr std::size_t max_dictionaries = 32;
+  static constexpr std::size_t max_size = header_size + 4 * max_dictionaries;
+  static constexpr unsigned char flag_no_compression = 1;
+
+  bool no_compression = false;
+  int max_window_log = 0;
+  int preferred_level = 0;
+  std::uint64_t sent_history_hash = 0;
+  std::uint64_t received_history_hash = 0;
+  std::size_t dictionary_count = 0;
+  unsigned dictionary_ids[max_dictionaries] = {};
+
+  /**
+   * @brief add_dictionary - announces a dictionary ID, IDs above
+   * max_dictionaries are dropped
+   */
+  void add_dictionary(unsigned id) noexcept
+  {
+    if (dictionary_count < max_dictionaries) {
+      dictionary_ids[dictionary_count++] = id;
+    }
+  }
+
+  bool has_dictionary(unsigned id) const noexcept
+  {
+    for (std::size_t i = 0; i < dictionary_count; ++i) {
+      if (dictionary_ids[i] == id)
+        return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief size - returns number of bytes of the record
+   */
+  std::size_t size() const noexcept
+  {
+    return header_size + 4 * dictionary_count;
+  }
+
+  /**
+   * @brief write - stores the record, out has at least max_size bytes
+   * @return number of bytes written
+   */
+  std::size_t write(unsigned char* out) const noexcept
+  {
+    for (std::size_t i = 0; i < 4; ++i) {
+      out[i] = magic[i];
+    }
+    out[4] = version;
+    out[5] = no_compression ? flag_no_compression : 0;
+    out[6] = static_cast<unsigned char>(max_window_log);
+    out[7] = static_cast<unsigned char>(dictionary_count);
+    write_u32(out + 8, static_cast<std::uint32_t>(preferred_level));
+    write_u64(out + 12, sent_history_hash);
+    write_u64(out + 20, received_history_hash);
+    for (std::size_t i = 0; i < dictionary_count; ++i) {
+      write_u32(out + header_size + 4 * i, dictionary_ids[i]);
+    }
+    return size();
+  }
+
+  /**
+   * @brief read_header - parses the first header_size bytes of a record,
+   * the dictionary IDs that follow are read by read_dictionaries()
+   * @return error_code with handshake_category if the data is not a record
+   * of a known version
+   */
+  error_code read_header(const unsigned char* data) noexcept
+  {
+    for (std::size_t i = 0; i < 4; ++i) {
+      if (data[i] != magic[i])
+        return make_error_code(handshake_error::invalid_record);
+    }
+    if (data[4] != version)
+      return make_error_code(handshake_error::unsupported_version);
+    if (data[7] > max_dictionaries)
+      return make_error_code(handshake_error::invalid_record);
+
+    no_compression = (data[5] & flag_no_compression) != 0;
+    max_window_log = data[6];
+    preferred_level = static_cast<std::int32_t>(read_u32(data + 8));
+    sent_history_hash = read_u64(data + 12);
+    received_history_hash = read_u64(data + 20);
+    dictionary_count = data[7];
+    return error_code();
+  }
+
+  /**
+   * @brief read_dictionaries - parses dictionary IDs of a record of size()
+   * bytes whose header was read
+   */
+  void read_dictionaries(const unsigned char* data) noexcept
+  {
+    for (std::size_t i = 0; i < dictionary_count; ++i) {
+      dictionary_ids[i] = read_u32(data + header_size + 4 * i);
+    }
+  }
+
+  static void write_u32(unsigned char* out, std::uint32_t value) noexcept
+  {
+    for (std::size_t i = 0; i < 4; ++i) {
+      out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+  }
+
+  static std::uint32_t read_u32(const unsigned char* data) noexcept
+  {
+    std::uint32_t value = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+      value |= std::uint32_t(data[i]) << (8 * i);
+    }
+    return value;
+  }
+
+  static void write_u64(unsigned char* out, std::uint64_t value) noexcept
+  {
+    write_u32(out, static_cast<std::uint32_t>(value));
+    write_u32(out + 4, static_cast<std::uint32_t>(value >> 32));
+  }
+
+  static std::uint64_t read_u64(const unsigned char* data) noexcept
+  {
+    return read_u32(data) | std::uint64_t(read_u32(data + 4)) << 32;
+  }
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
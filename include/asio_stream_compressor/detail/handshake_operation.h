@@ -0,0 +1,193 @@
+#pragma once
+
+#include "compression_core.h"
+#include "handshake.h"
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The async_handshake_operation class sends the capability record of
+ * the compressor, reads the record of the peer and configures the codec from
+ * both.
+ *
+ * Both peers send first, so the handshake works without a client and a
+ * server role. Bytes the peer sent after its record stay in input_buf_ for
+ * the first read.
+ */
+template<class Stream, class Core, class Handler>
+class async_handshake_operation
+{
+public:
+  using self = async_handshake_operation<Stream, Core, Handler>;
+
+  async_handshake_operation(Stream& stream,
+                            Core& core,
+                            const handshake_options& options,
+                            Handler&& handler)
+      : stream_(stream)
+      , core_(core)
+      , options_(options)
+      , allocator_(asio::get_associated_allocator(
+            handler, core.get_handler_allocator()))
+      , handler_(std::forward<decltype(handler)>(handler))
+  {
+  }
+
+  async_handshake_operation(self&& o)
+      : stream_(o.stream_)
+      , core_(o.core_)
+      , options_(o.options_)
+      , allocator_(std::move(o.allocator_))
+      , handler_(std::move(o.handler_))
+      , state_(o.state_)
+  {
+  }
+
+  void operator()(error_code ec, std::size_t bytes_transferred = 0)
+  {
+    switch (state_) {
+      case state::send_record: {
+        handshake_record record = core_.make_handshake_record(options_);
+        auto buf = core_.write_buf_.prepare(handshake_record::max_size);
+        core_.write_buf_.commit(
+            record.write(static_cast<unsigned char*>(buf.data())));
+        state_ = state::record_sent;
+        asio::async_write(
+            stream_.next_layer(), core_.write_buf_.data(), std::move(*this));
+        return;
+      }
+
+      case state::record_sent: {
+        core_.write_buf_.consume(core_.write_buf_.size());
+        if (ec)
+          break;
+
+        state_ = state::read_record;
+        bytes_transferred = 0;
+        [[fallthrough]];
+      }
+
+      case state::read_record: {
+        if (ec)
+          break;
+
+        core_.input_buf_.commit(bytes_transferred);
+        if (read_record(ec))
+          break;
+
+        auto bufs = core_.input_buf_.prepare(core_.read_size_.next_size());
+        stream_.next_layer().async_read_some(bufs, std::move(*this));
+        return;
+      }
+    }
+
+    handler_(ec);
+  }
+
+  using executor_type = asio::associated_executor_t<
+      Handler,
+      typename Stream::next_layer_type::executor_type>;
+
+  /**
+   * @brief get_executor - returns executor associated with the handler, so
+   * the next layer resumes the operation where the handler would run
+   */
+  executor_type get_executor() const noexcept
+  {
+    return asio::get_associated_executor(handler_,
+                                         stream_.next_layer().get_executor());
+  }
+
+  using allocator_type = asio::associated_allocator_t<
+      Handler,
+      typename Core::handler_allocator_type>;
+
+  /**
+   * @brief get_allocator - returns allocator associated with the handler or
+   * the recycling allocator of the compressor if there is none
+   */
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+private:
+  /**
+   * @brief read_record - parses the record of the peer once it is received
+   * and applies it
+   * @return true if the handshake is finished
+   */
+  bool read_record(error_code& ec)
+  {
+    auto data =
+        static_cast<const unsigned char*>(core_.input_buf_.data().data());
+    std::size_t size = core_.input_buf_.size();
+    if (size < handshake_record::header_size)
+      return false;
+
+    handshake_record peer;
+    ec = peer.read_header(data);
+    if (ec)
+      return true;
+    if (size < peer.size())
+      return false;
+
+    peer.read_dictionaries(data);
+    core_.input_buf_.consume(peer.size());
+    ec = core_.apply_handshake(peer, options_);
+    return true;
+  }
+
+  enum class state
+  {
+    send_record,
+    record_sent,
+    read_record,
+  };
+
+  Stream& stream_;
+  Core& core_;
+  handshake_options options_;
+  // initialized from the handler before it is moved to handler_
+  allocator_type allocator_;
+  Handler handler_;
+
+  state state_ = state::send_record;
+};
+
+template<typename Stream, class Core>
+class initiate_async_handshake
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_async_handshake(Stream& stream, Core& core)
+      : stream_(stream)
+      , core_(core)
+  {
+  }
+  initiate_async_handshake(const initiate_async_handshake&) = default;
+  initiate_async_handshake(initiate_async_handshake&&) = default;
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler>
+  void operator()(Handler&& handler, const handshake_options& options) const
+  {
+    async_handshake_operation(
+        stream_, core_, options, std::forward<decltype(handler)>(handler))(
+        error_code());
+  }
+
+private:
+  Stream& stream_;
+  Core& core_;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
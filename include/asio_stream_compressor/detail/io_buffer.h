@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "buffer_pool.h"
+#include "defines.h"
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The io_buffer class is a contiguous buffer with the part of the
+ * basic_streambuf interface used by the compressor.
+ *
+ * Without a pool the memory comes from the allocator and is kept like in a
+ * basic_streambuf. With a buffer_pool the memory is a chunk of the pool and
+ * goes back to it as soon as all data is consumed.
+ */
+template<class Allocator>
+class io_buffer
+{
+public:
+  using const_buffers_type = asio::const_buffer;
+  using mutable_buffers_type = asio::mutable_buffer;
+
+  explicit io_buffer(const Allocator& alloc) noexcept
+      : alloc_(alloc)
+  {
+  }
+
+  io_buffer(io_buffer&& o) noexcept
+      : alloc_(o.alloc_)
+      , pool_(std::move(o.pool_))
+      , data_(std::exchange(o.data_, nullptr))
+      , capacity_(std::exchange(o.capacity_, 0))
+      , begin_(std::exchange(o.begin_, 0))
+      , end_(std::exchange(o.end_, 0))
+  {
+  }
+
+  io_buffer& operator=(io_buffer&& o) noexcept
+  {
+    if (this != &o) {
+      free_storage();
+      alloc_ = o.alloc_;
+      pool_ = std::move(o.pool_);
+      data_ = std::exchange(o.data_, nullptr);
+      capacity_ = std::exchange(o.capacity_, 0);
+      begin_ = std::exchange(o.begin_, 0);
+      end_ = std::exchange(o.end_, 0);
+    }
+    return *this;
+  }
+
+  ~io_buffer()
+  {
+    free_storage();
+  }
+
+  /**
+   * @brief set_pool - takes memory from the pool, or from the allocator if
+   * pool is nullptr. Data in the buffer is dropped.
+   */
+  void set_pool(const buffer_pool* pool) noexcept
+  {
+    free_storage();
+    if (pool) {
+      pool_ = *pool;
+    } else {
+      pool_.reset();
+    }
+  }
+
+  bool pooled() const noexcept
+  {
+    return pool_.has_value();
+  }
+
+  std::size_t size() const noexcept
+  {
+    return end_ - begin_;
+  }
+
+  std::size_t capacity() const noexcept
+  {
+    return capacity_;
+  }
+
+  const_buffers_type data() const noexcept
+  {
+    return const_buffers_type(data_ + begin_, size());
+  }
+
+  /**
+   * @brief prepare - returns n bytes of space after the data
+   */
+  mutable_buffers_type prepare(std::size_t n)
+  {
+    if (capacity_ - end_ < n) {
+      reserve(n);
+    }
+    return mutable_buffers_type(data_ + end_, n);
+  }
+
+  void commit(std::size_t n) noexcept
+  {
+    end_ += (std::min)(n, capacity_ - end_);
+  }
+
+  void consume(std::size_t n) noexcept
+  {
+    begin_ += (std::min)(n, size());
+    if (begin_ != end_)
+      return;
+
+    begin_ = end_ = 0;
+    if (pool_) {
+      free_storage();
+    }
+  }
+
+  /**
+   * @brief shrink - frees the memory of an empty buffer
+   */
+  void shrink() noexcept
+  {
+    if (size() == 0) {
+      free_storage();
+    }
+  }
+
+private:
+  using char_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<char>;
+
+  void reserve(std::size_t n)
+  {
+    std::size_t size = this->size();
+    if (capacity_ - size >= n) {
+      // moving the data to the front is enough
+      std::memmove(data_, data_ + begin_, size);
+      begin_ = 0;
+      end_ = size;
+      return;
+    }
+
+    std::size_t capacity = (std::max)(size + n, capacity_ * 2);
+    char* data = pool_ ? static_cast<char*>(pool_->acquire(capacity))
+                       : char_allocator(alloc_).allocate(capacity);
+    if (size != 0) {
+      std::memcpy(data, data_ + begin_, size);
+    }
+    free_storage();
+    data_ = data;
+    capacity_ = capacity;
+    begin_ = 0;
+    end_ = size;
+  }
+
+  void free_storage() noexcept
+  {
+    if (!data_)
+      return;
+
+    if (pool_) {
+      pool_->release(data_, capacity_);
+    } else {
+      char_allocator(alloc_).deallocate(data_, capacity_);
+    }
+    data_ = nullptr;
+    capacity_ = 0;
+    begin_ = end_ = 0;
+  }
+
+  Allocator alloc_;
+  std::optional<buffer_pool> pool_;
+  char* data_ = nullptr;
+  std::size_t capacity_ = 0;
+  std::size_t begin_ = 0;
+  std::size_t end_ = 0;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
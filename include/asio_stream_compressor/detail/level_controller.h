@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The level_controller class adapts the compression level to the
+ * bottleneck of the connection in a way similar to zstd --adapt.
+ *
+ * Time spent in the encoder is compared with time the next layer needs to
+ * accept the encoded data. When sending takes longer the link is the
+ * bottleneck and a stronger level costs nothing, when encoding takes longer a
+ * faster level increases throughput.
+ */
+class level_controller
+{
+public:
+  using duration = std::chrono::steady_clock::duration;
+
+  /** @brief number of sent bytes between two decisions */
+  static constexpr std::size_t window = 256 * 1024;
+
+  void enable(int min_level, int max_level, int level) noexcept
+  {
+    min_level_ = min_level;
+    max_level_ = max_level;
+    restart(level);
+  }
+
+  /**
+   * @brief limit - lowers the highest level the controller may pick
+   */
+  void limit(int max_level) noexcept
+  {
+    if (max_level_ <= max_level)
+      return;
+
+    max_level_ = max_level;
+    if (min_level_ > max_level_) {
+      min_level_ = max_level_;
+    }
+    restart(level_);
+  }
+
+  /**
+   * @brief restart - sets the current level and drops collected timings
+   */
+  void restart(int level) noexcept
+  {
+    level_ = level < min_level_ ? min_level_
+        : level > max_level_    ? max_level_
+                                : level;
+    encode_time_ = duration::zero();
+    send_time_ = duration::zero();
+    sent_bytes_ = 0;
+  }
+
+  bool enabled() const noexcept
+  {
+    return min_level_ != max_level_;
+  }
+
+  int level() const noexcept
+  {
+    return level_;
+  }
+
+  void on_encoded(duration time) noexcept
+  {
+    encode_time_ += time;
+  }
+
+  void on_sent(duration time, std::size_t bytes) noexcept
+  {
+    send_time_ += time;
+    sent_bytes_ += bytes;
+  }
+
+  /**
+   * @brief update - decides on a new level once a window of data was sent
+   * @return true if the level changed
+   */
+  bool update() noexcept
+  {
+    if (sent_bytes_ < window)
+      return false;
+
+    int level = level_;
+    // require a clear difference so the level does not oscillate
+    if (send_time_ > 2 * encode_time_ && level_ < max_level_) {
+      ++level;
+    } else if (encode_time_ > 2 * send_time_ && level_ > min_level_) {
+      --level;
+    }
+    bool changed = level != level_;
+    restart(level);
+    return changed;
+  }
+
+private:
+  int min_level_ = 0;
+  int max_level_ = 0;
+  int level_ = 0;
+  duration encode_time_ = duration::zero();
+  duration send_time_ = duration::zero();
+  std::size_t sent_bytes_ = 0;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
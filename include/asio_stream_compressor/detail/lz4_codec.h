@@ -0,0 +1,599 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <lz4frame.h>
+
+#include "codec.h"
+#include "compressor_statistics.h"
+#include "compute_executor.h"
+#include "defines.h"
+#include "handler_memory.h"
+#include "io_buffer.h"
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The lz4_error_category class is used to distinguish errors of the
+ * lz4 frame API.
+ */
+class lz4_error_category_impl : public error_category
+{
+public:
+  // error_category interface
+  const char* name() const noexcept override
+  {
+    return "lz4_error";
+  }
+
+  std::string message(int ev) const override
+  {
+    // lz4 returns errors as negated codes in a size_t
+    return LZ4F_getErrorName(
+        static_cast<LZ4F_errorCode_t>(-static_cast<std::ptrdiff_t>(ev)));
+  }
+};
+
+inline const error_category& lz4_error_category()
+{
+  static lz4_error_category_impl instance;
+  return instance;
+}
+
+namespace detail
+{
+inline error_code make_lz4_error_code(std::size_t result) noexcept
+{
+  return error_code(static_cast<int>(-static_cast<std::ptrdiff_t>(result)),
+                    lz4_error_category());
+}
+
+struct lz4_cctx_deleter
+{
+  void operator()(LZ4F_cctx* ptr)
+  {
+    LZ4F_freeCompressionContext(ptr);
+  }
+};
+
+struct lz4_dctx_deleter
+{
+  void operator()(LZ4F_dctx* ptr)
+  {
+    LZ4F_freeDecompressionContext(ptr);
+  }
+};
+
+using lz4_cctx_uptr = std::unique_ptr<LZ4F_cctx, lz4_cctx_deleter>;
+using lz4_dctx_uptr = std::unique_ptr<LZ4F_dctx, lz4_dctx_deleter>;
+
+/**
+ * @brief The lz4_core class is the state of a compressor that uses the lz4
+ * frame API.
+ *
+ * The encoder writes one frame of linked blocks and flushes it after every
+ * write, so the peer decodes each write as soon as it arrives. Contexts are
+ * created by the first read and write.
+ */
+template<class Executor, class Allocator>
+class lz4_core : public Allocator
+{
+public:
+  using self = lz4_core<Executor, Allocator>;
+  using handler_allocator_type = handler_allocator<void, Allocator>;
+
+  /** @brief number of bytes read from the next layer at once */
+  static constexpr std::size_t read_size = 64 * 1024;
+  /** @brief input is passed to the encoder in chunks of one block */
+  static constexpr std::size_t chunk_size = 64 * 1024;
+
+  lz4_core(int level, const Executor&, const Allocator& alloc)
+      : Allocator(alloc)
+      , input_buf_(alloc)
+      , write_buf_(alloc)
+      , handler_memory_(std::allocate_shared<handler_memory<Allocator>>(
+            alloc, alloc))
+  {
+    prefs_.compressionLevel = level;
+    prefs_.autoFlush = 1;
+    prefs_.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs_.frameInfo.blockMode = LZ4F_blockLinked;
+  }
+
+  lz4_core(self&&) = default;
+
+  self& operator=(self&&) = default;
+
+  void reset() noexcept
+  {
+    cctx_.reset();
+    dctx_.reset();
+    frame_open_ = false;
+    input_buf_.consume(input_buf_.size());
+    write_buf_.consume(write_buf_.size());
+    stats_.reset();
+  }
+
+  const Allocator& get_allocator() const noexcept
+  {
+    return *this;
+  }
+
+  compressor_statistics& get_statistics() noexcept
+  {
+    return stats_;
+  }
+
+  const compressor_statistics& get_statistics() const noexcept
+  {
+    return stats_;
+  }
+
+  int get_compression_level() const noexcept
+  {
+    return prefs_.compressionLevel;
+  }
+
+  /**
+   * @brief get_handler_allocator - returns allocator of operations whose
+   * handler has no associated allocator
+   */
+  handler_allocator_type get_handler_allocator() const noexcept
+  {
+    return handler_allocator_type(handler_memory_);
+  }
+
+  /**
+   * @brief encode - compresses the buffers to write_buf_ and flushes them
+   */
+  template<class ConstBufferSequence>
+  error_code encode(const ConstBufferSequence& buffers)
+  {
+    if (!cctx_) {
+      LZ4F_cctx* cctx = nullptr;
+      std::size_t status = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+      if (LZ4F_isError(status))
+        return make_lz4_error_code(status);
+      cctx_.reset(cctx);
+    }
+
+    if (!frame_open_) {
+      auto buf = write_buf_.prepare(LZ4F_HEADER_SIZE_MAX);
+      std::size_t status =
+          LZ4F_compressBegin(cctx_.get(), buf.data(), buf.size(), &prefs_);
+      if (LZ4F_isError(status))
+        return make_lz4_error_code(status);
+      write_buf_.commit(status);
+      frame_open_ = true;
+    }
+
+    auto buffers_begin = asio::buffer_sequence_begin(buffers);
+    auto buffers_end   = asio::buffer_sequence_end(buffers);
+    for (auto it = buffers_begin; it != buffers_end; ++it) {
+      asio::const_buffer in = *it;
+      while (in.size() != 0) {
+        std::size_t size = (std::min)(in.size(), chunk_size);
+        auto buf = write_buf_.prepare(LZ4F_compressBound(size, &prefs_));
+        // autoFlush compresses the end of the chunk right away
+        std::size_t status = LZ4F_compressUpdate(
+            cctx_.get(), buf.data(), buf.size(), in.data(), size, nullptr);
+        if (LZ4F_isError(status))
+          return make_lz4_error_code(status);
+        write_buf_.commit(status);
+        in += size;
+      }
+    }
+    return error_code();
+  }
+
+  /**
+   * @brief decode - decodes input_buf_ to the buffers
+   * @return number of bytes written to the buffers
+   */
+  template<class MutableBufferSequence>
+  std::size_t decode(const MutableBufferSequence& buffers, error_code& ec)
+  {
+    if (!dctx_) {
+      LZ4F_dctx* dctx = nullptr;
+      std::size_t status =
+          LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+      if (LZ4F_isError(status)) {
+        ec = make_lz4_error_code(status);
+        return 0;
+      }
+      dctx_.reset(dctx);
+    }
+
+    std::size_t produced = 0;
+    auto buffers_begin = asio::buffer_sequence_begin(buffers);
+    auto buffers_end   = asio::buffer_sequence_end(buffers);
+    for (auto it = buffers_begin; it != buffers_end; ++it) {
+      asio::mutable_buffer out = *it;
+      while (out.size() != 0) {
+        std::size_t dst_size = out.size();
+        std::size_t src_size = input_buf_.size();
+        std::size_t status = LZ4F_decompress(dctx_.get(),
+                                             out.data(),
+                                             &dst_size,
+                                             input_buf_.data().data(),
+                                             &src_size,
+                                             nullptr);
+        input_buf_.consume(src_size);
+        if (LZ4F_isError(status)) {
+          ec = make_lz4_error_code(status);
+          return produced;
+        }
+        produced += dst_size;
+        out += dst_size;
+        // the decoder needs more input
+        if (dst_size == 0 && src_size == 0)
+          return produced;
+      }
+    }
+    return produced;
+  }
+
+  io_buffer<Allocator> input_buf_;
+  io_buffer<Allocator> write_buf_;
+
+private:
+  LZ4F_preferences_t prefs_ {};
+  lz4_cctx_uptr cctx_;
+  lz4_dctx_uptr dctx_;
+  /** @brief the encoder wrote the header of its frame */
+  bool frame_open_ = false;
+  compressor_statistics stats_;
+  std::shared_ptr<handler_memory<Allocator>> handler_memory_;
+};
+
+template<class Stream, class Core, class Handler, class ConstBufferSequence>
+class async_lz4_write_operation
+{
+public:
+  using self =
+      async_lz4_write_operation<Stream, Core, Handler, ConstBufferSequence>;
+
+  async_lz4_write_operation(Stream& stream,
+                            Core& core,
+                            const ConstBufferSequence& buffers,
+                            Handler&& handler)
+      : stream_(stream)
+      , core_(core)
+      , buffers_(buffers)
+      , allocator_(asio::get_associated_allocator(
+            handler, core.get_handler_allocator()))
+      , handler_(std::forward<decltype(handler)>(handler))
+  {
+  }
+
+  async_lz4_write_operation(self&& o)
+      : stream_(o.stream_)
+      , core_(o.core_)
+      , buffers_(o.buffers_)
+      , allocator_(std::move(o.allocator_))
+      , handler_(std::move(o.handler_))
+      , state_(o.state_)
+      , ec_(o.ec_)
+      , input_length_(o.input_length_)
+  {
+  }
+
+  void operator()(error_code ec, std::size_t = 0)
+  {
+    switch (state_) {
+      case state::encode_data: {
+        ec_ = core_.encode(buffers_);
+        if (ec_) {
+          core_.write_buf_.consume(core_.write_buf_.size());
+          // called from the initiate function, the handler must not be
+          // invoked before it returns
+          state_ = state::report_error;
+          auto io_ex = get_executor();
+          post_immediate(handler_, io_ex, std::move(*this));
+          return;
+        }
+
+        input_length_ = asio::buffer_size(buffers_);
+        state_ = state::pass_data_to_handler;
+        asio::async_write(
+            stream_.next_layer(), core_.write_buf_.data(), std::move(*this));
+        return;
+      }
+
+      case state::pass_data_to_handler: {
+        if (!ec) {
+          core_.get_statistics().tx_bytes_total.fetch_add(
+              input_length_, std::memory_order_relaxed);
+          core_.get_statistics().tx_bytes_compressed.fetch_add(
+              core_.write_buf_.size(), std::memory_order_relaxed);
+        }
+        core_.write_buf_.consume(core_.write_buf_.size());
+        handler_(ec, ec ? 0 : input_length_);
+        return;
+      }
+
+      case state::report_error: {
+        handler_(ec_, 0);
+        return;
+      }
+    }
+  }
+
+  using executor_type = asio::associated_executor_t<
+      Handler,
+      typename Stream::next_layer_type::executor_type>;
+
+  /**
+   * @brief get_executor - returns executor associated with the handler, so
+   * the next layer resumes the operation where the handler would run
+   */
+  executor_type get_executor() const noexcept
+  {
+    return asio::get_associated_executor(handler_,
+                                         stream_.next_layer().get_executor());
+  }
+
+  using allocator_type = asio::associated_allocator_t<
+      Handler,
+      typename Core::handler_allocator_type>;
+
+  /**
+   * @brief get_allocator - returns allocator associated with the handler or
+   * the recycling allocator of the compressor if there is none
+   */
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+private:
+  enum class state
+  {
+    encode_data,
+    pass_data_to_handler,
+    report_error,
+  };
+
+  Stream& stream_;
+  Core& core_;
+  ConstBufferSequence buffers_;
+  // initialized from the handler before it is moved to handler_
+  allocator_type allocator_;
+  Handler handler_;
+
+  state state_ = state::encode_data;
+  error_code ec_;
+  std::size_t input_length_ = 0;
+};
+
+template<class Stream, class Core, class Handler, class MutableBufferSequence>
+class async_lz4_read_operation
+{
+public:
+  using self =
+      async_lz4_read_operation<Stream, Core, Handler, MutableBufferSequence>;
+
+  async_lz4_read_operation(Stream& stream,
+                           Core& core,
+                           const MutableBufferSequence& buffers,
+                           Handler&& handler)
+      : stream_(stream)
+      , core_(core)
+      , buffers_(buffers)
+      , allocator_(asio::get_associated_allocator(
+            handler, core.get_handler_allocator()))
+      , handler_(std::forward<decltype(handler)>(handler))
+  {
+  }
+
+  async_lz4_read_operation(self&& o)
+      : stream_(o.stream_)
+      , core_(o.core_)
+      , buffers_(o.buffers_)
+      , allocator_(std::move(o.allocator_))
+      , handler_(std::move(o.handler_))
+      , state_(o.state_)
+      , ec_(o.ec_)
+      , bytes_written_(o.bytes_written_)
+  {
+  }
+
+  void operator()(error_code ec,
+                  std::size_t bytes_transferred = std::size_t(0),
+                  bool start = false)
+  {
+    switch (state_) {
+      case state::decode_data: {
+        if (bytes_transferred != 0) {
+          core_.input_buf_.commit(bytes_transferred);
+          core_.get_statistics().rx_bytes_compressed.fetch_add(
+              bytes_transferred, std::memory_order_relaxed);
+        }
+        if (ec) {
+          ec_ = ec;
+          break;
+        }
+
+        bytes_written_ = core_.decode(buffers_, ec_);
+        if (ec_ || bytes_written_ != 0 || asio::buffer_size(buffers_) == 0)
+          break;
+
+        auto bufs = core_.input_buf_.prepare(Core::read_size);
+        stream_.next_layer().async_read_some(bufs, std::move(*this));
+        return;
+      }
+
+      case state::pass_data_to_handler: {
+        handler_(ec_, bytes_written_);
+        return;
+      }
+    }
+
+    core_.get_statistics().rx_bytes_total.fetch_add(bytes_written_,
+                                                    std::memory_order_relaxed);
+    // if this function is called directly from initiate function the
+    // handler must not be invoked before it returns
+    if (start) {
+      state_ = state::pass_data_to_handler;
+      auto io_ex = get_executor();
+      post_immediate(handler_, io_ex, std::move(*this));
+      return;
+    }
+    handler_(ec_, bytes_written_);
+  }
+
+  using executor_type = asio::associated_executor_t<
+      Handler,
+      typename Stream::next_layer_type::executor_type>;
+
+  /**
+   * @brief get_executor - returns executor associated with the handler, so
+   * the next layer resumes the operation where the handler would run
+   */
+  executor_type get_executor() const noexcept
+  {
+    return asio::get_associated_executor(handler_,
+                                         stream_.next_layer().get_executor());
+  }
+
+  using allocator_type = asio::associated_allocator_t<
+      Handler,
+      typename Core::handler_allocator_type>;
+
+  /**
+   * @brief get_allocator - returns allocator associated with the handler or
+   * the recycling allocator of the compressor if there is none
+   */
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+private:
+  enum class state
+  {
+    decode_data,
+    pass_data_to_handler,
+  };
+
+  Stream& stream_;
+  Core& core_;
+  MutableBufferSequence buffers_;
+  // initialized from the handler before it is moved to handler_
+  allocator_type allocator_;
+  Handler handler_;
+
+  state state_ = state::decode_data;
+  error_code ec_;
+  std::size_t bytes_written_ = 0;
+};
+
+template<typename Stream, class Core>
+class initiate_lz4_read_some
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_lz4_read_some(Stream& stream, Core& core)
+      : stream_(stream)
+      , core_(core)
+  {
+  }
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler, class MutableBufferSequence>
+  void operator()(Handler&& handler,
+                  const MutableBufferSequence& buffers) const
+  {
+    async_lz4_read_operation(
+        stream_, core_, buffers, std::forward<decltype(handler)>(handler))(
+        error_code(), 0, true);
+  }
+
+private:
+  Stream& stream_;
+  Core& core_;
+};
+
+template<typename Stream, class Core>
+class initiate_lz4_write_some
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_lz4_write_some(Stream& stream, Core& core)
+      : stream_(stream)
+      , core_(core)
+  {
+  }
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler, class ConstBufferSequence>
+  void operator()(Handler&& handler, const ConstBufferSequence& buffers) const
+  {
+    async_lz4_write_operation(
+        stream_, core_, buffers, std::forward<decltype(handler)>(handler))(
+        error_code());
+  }
+
+private:
+  Stream& stream_;
+  Core& core_;
+};
+
+}  // namespace detail
+
+/**
+ * @brief The lz4_codec struct selects the lz4 frame API, which compresses
+ * less than zstd at a fraction of its CPU cost.
+ *
+ * Every write is flushed, so async_flush() completes immediately. Only the
+ * options every codec has are available, and one read and one write may be
+ * in progress at a time. The compression level is the one passed to the
+ * constructor: 0 is the fast default, higher levels use lz4 HC. Both peers
+ * must use lz4_codec.
+ *
+ * The application links liblz4, which the library does not require
+ * otherwise.
+ *
+ * Example:
+ * @code
+ * asio_stream_compressor::compressor<ip::tcp::socket,
+ *                                    std::allocator<char>,
+ *                                    asio_stream_compressor::lz4_codec>
+ *     sock(ctx);
+ * @endcode
+ */
+struct lz4_codec
+{
+  template<class Executor, class Allocator>
+  using core = detail::lz4_core<Executor, Allocator>;
+
+  template<class Stream, class Core>
+  using initiate_read_some = detail::initiate_lz4_read_some<Stream, Core>;
+
+  template<class Stream, class Core>
+  using initiate_write_some = detail::initiate_lz4_write_some<Stream, Core>;
+
+  template<class Stream, class Core>
+  using initiate_flush = detail::initiate_immediate_flush<Stream, Core>;
+
+  static int default_level() noexcept
+  {
+    return 0;
+  }
+};
+
+}  // namespace asio_stream_compressor
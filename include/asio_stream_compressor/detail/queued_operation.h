@@ -0,0 +1,228 @@
+#pragma once
+
+#include <memory>
+#include <new>
+
+#include "defines.h"
+#include "wait_queue.h"
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The queued_read class is a type-erased read operation that waits
+ * until the read lock of the compression_core is released.
+ */
+class queued_read : public wait_queue_node<queued_read>
+{
+public:
+  /**
+   * @brief resume - continues the operation as the owner of the read lock.
+   * The object is destroyed after this call.
+   */
+  void resume()
+  {
+    func_(this);
+  }
+
+protected:
+  using func_type = void (*)(queued_read*);
+
+  explicit queued_read(func_type func) noexcept
+      : func_(func)
+  {
+  }
+
+  ~queued_read() = default;
+
+private:
+  func_type func_;
+};
+
+/**
+ * @brief The queued_write class is a type-erased write operation that waits
+ * until the write lock of the compression_core is released.
+ *
+ * The owner of the lock encodes all queued writes together with its own data
+ * so they share one flush and one write to the next layer.
+ */
+class queued_write : public wait_queue_node<queued_write>
+{
+public:
+  enum class action
+  {
+    resume,  ///< become the owner of the write lock
+    encode,  ///< encode data as a part of the owner's batch
+    complete,  ///< batch was sent, invoke the completion handler
+  };
+
+  /**
+   * @brief resume - continues the operation as the owner of the write lock.
+   * The object is destroyed after this call.
+   */
+  void resume()
+  {
+    func_(this, action::resume, nullptr);
+  }
+
+  /**
+   * @brief encode - passes data of the operation to the encoder
+   */
+  error_code encode()
+  {
+    error_code ec;
+    func_(this, action::encode, &ec);
+    return ec;
+  }
+
+  /**
+   * @brief complete - invokes the completion handler of the operation through
+   * its associated executor. The object is destroyed after this call.
+   */
+  void complete(error_code ec)
+  {
+    func_(this, action::complete, &ec);
+  }
+
+  /**
+   * @brief is_flush - returns true if the operation was started by
+   * async_flush()
+   */
+  bool is_flush() const noexcept
+  {
+    return is_flush_;
+  }
+
+  /**
+   * @brief input_size - returns number of bytes the operation writes
+   */
+  std::size_t input_size() const noexcept
+  {
+    return input_size_;
+  }
+
+protected:
+  using func_type = void (*)(queued_write*, action, error_code*);
+
+  queued_write(func_type func, bool is_flush, std::size_t input_size) noexcept
+      : func_(func)
+      , is_flush_(is_flush)
+      , input_size_(input_size)
+  {
+  }
+
+  ~queued_write() = default;
+
+private:
+  func_type func_;
+  bool is_flush_;
+  std::size_t input_size_;
+};
+
+/**
+ * @brief The queued_operation_storage class allocates memory for queued
+ * operations using the allocator associated with the completion handler.
+ *
+ * Handlers without an associated allocator use the recycling memory of the
+ * compressor, so waiting does not hit the global heap in steady state.
+ */
+template<class Node, class Operation>
+class queued_operation_storage
+{
+public:
+  using allocator_type = typename std::allocator_traits<decltype(
+      std::declval<const Operation&>().get_allocator())>::
+      template rebind_alloc<Node>;
+
+  static Node* create(Operation&& op)
+  {
+    allocator_type alloc(op.get_allocator());
+    Node* ptr = std::allocator_traits<allocator_type>::allocate(alloc, 1);
+    return new (ptr) Node(std::move(op));
+  }
+
+  /**
+   * @brief release - takes the operation out of the node and frees the
+   * memory before the operation continues
+   */
+  static Operation release(Node* node, Operation& op)
+  {
+    Operation result(std::move(op));
+    allocator_type alloc(result.get_allocator());
+    node->~Node();
+    std::allocator_traits<allocator_type>::deallocate(alloc, node, 1);
+    return result;
+  }
+};
+
+template<class Operation>
+class queued_read_operation : public queued_read
+{
+  using storage = queued_operation_storage<queued_read_operation, Operation>;
+  friend storage;
+
+public:
+  static queued_read* create(Operation&& op)
+  {
+    return storage::create(std::move(op));
+  }
+
+private:
+  explicit queued_read_operation(Operation&& op)
+      : queued_read(&queued_read_operation::do_resume)
+      , op_(std::move(op))
+  {
+  }
+
+  static void do_resume(queued_read* base)
+  {
+    auto* node = static_cast<queued_read_operation*>(base);
+    storage::release(node, node->op_).resume_queued();
+  }
+
+  Operation op_;
+};
+
+template<class Operation>
+class queued_write_operation : public queued_write
+{
+  using storage = queued_operation_storage<queued_write_operation, Operation>;
+  friend storage;
+
+public:
+  static queued_write* create(Operation&& op)
+  {
+    return storage::create(std::move(op));
+  }
+
+private:
+  explicit queued_write_operation(Operation&& op)
+      : queued_write(&queued_write_operation::do_func,
+                     Operation::is_flush,
+                     op.input_size())
+      , op_(std::move(op))
+  {
+  }
+
+  static void do_func(queued_write* base, action a, error_code* ec)
+  {
+    auto* node = static_cast<queued_write_operation*>(base);
+    if (a == action::encode) {
+      *ec = node->op_.encode_batched();
+      return;
+    }
+
+    Operation op = storage::release(node, node->op_);
+    if (a == action::resume) {
+      op.resume_queued();
+    } else {
+      op.complete_batched(*ec);
+    }
+  }
+
+  Operation op_;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief raw_frame_header_size - magic number, frame header descriptor and
+ * window descriptor
+ */
+constexpr std::size_t raw_frame_header_size = 6;
+constexpr std::size_t raw_block_header_size = 3;
+/** @brief maximum block size allowed by the zstd format */
+constexpr std::size_t raw_block_max_size = 128 * 1024;
+/** @brief window logs of the smallest window and of the largest block */
+constexpr unsigned raw_window_log_min = 10;
+constexpr unsigned raw_window_log_max = 17;
+
+/**
+ * @brief raw_window_log - returns the window log of a raw frame of size
+ * bytes, the smallest that fits the data up to max_window_log
+ */
+inline unsigned raw_window_log(std::size_t size,
+                               unsigned max_window_log) noexcept
+{
+  if (max_window_log > raw_window_log_max) {
+    max_window_log = raw_window_log_max;
+  }
+  unsigned window_log = raw_window_log_min;
+  while (window_log < max_window_log
+         && (std::size_t(1) << window_log) < size)
+  {
+    ++window_log;
+  }
+  return window_log;
+}
+
+/**
+ * @brief raw_frame_size - returns number of bytes write_raw_frame() needs for
+ * size bytes of data
+ */
+inline std::size_t raw_frame_size(
+    std::size_t size, unsigned max_window_log = raw_window_log_max) noexcept
+{
+  const std::size_t block_max_size = std::size_t(1)
+      << raw_window_log(size, max_window_log);
+  std::size_t blocks = (size + block_max_size - 1) / block_max_size;
+  if (blocks == 0)
+    blocks = 1;
+  return raw_frame_header_size + blocks * raw_block_header_size + size;
+}
+
+/**
+ * @brief write_raw_frame - stores data as a zstd frame made of raw blocks
+ * @param out - buffer of at least raw_frame_size(size) bytes
+ * @param data - data to store
+ * @param size - size of data
+ * @param max_window_log - largest window the frame may declare, the window
+ * of the encoder so a decoder of the peer that limits it accepts the frame
+ * @return number of bytes written to out
+ *
+ * Raw blocks are part of the zstd format, so any zstd decoder reads the frame
+ * without knowing that it was not compressed.
+ */
+inline std::size_t write_raw_frame(
+    unsigned char* out,
+    const unsigned char* data,
+    std::size_t size,
+    unsigned max_window_log = raw_window_log_max) noexcept
+{
+  // blocks cannot be larger than the window, which is also the amount of
+  // memory the decoder reserves, so use the smallest window that fits
+  const unsigned window_log = raw_window_log(size, max_window_log);
+  const std::size_t block_max_size = std::size_t(1) << window_log;
+
+  unsigned char* pos = out;
+  const std::uint32_t magic = 0xFD2FB528;
+  for (int i = 0; i < 4; ++i) {
+    *pos++ = static_cast<unsigned char>(magic >> (8 * i));
+  }
+  // no content size, no checksum, no dictionary
+  *pos++ = 0;
+  *pos++ = static_cast<unsigned char>((window_log - 10) << 3);
+
+  do {
+    std::size_t block_size = size < block_max_size ? size : block_max_size;
+    size -= block_size;
+
+    // last block flag, block type 0 (raw), block size
+    std::uint32_t header = (size == 0 ? 1u : 0u)
+        | static_cast<std::uint32_t>(block_size << 3);
+    *pos++ = static_cast<unsigned char>(header);
+    *pos++ = static_cast<unsigned char>(header >> 8);
+    *pos++ = static_cast<unsigned char>(header >> 16);
+
+    std::memcpy(pos, data, block_size);
+    pos += block_size;
+    data += block_size;
+  } while (size != 0);
+
+  return static_cast<std::size_t>(pos - out);
+}
+
+/**
+ * @brief missing_frame_header_bytes - returns number of bytes missing from
+ * the start of a zstd frame up to the end of its dictionary ID
+ * @return 0 if the dictionary ID can be read or data is not a zstd frame
+ *
+ * The layout of the header is fixed by the zstd format (RFC 8878), so this
+ * does not need ZSTD_getFrameHeader() from the experimental API.
+ */
+inline std::size_t missing_frame_header_bytes(const void* data,
+                                              std::size_t size) noexcept
+{
+  // magic number and frame header descriptor
+  constexpr std::size_t prefix_size = 5;
+  if (size < prefix_size)
+    return prefix_size - size;
+
+  auto bytes = static_cast<const unsigned char*>(data);
+  std::uint32_t magic = 0;
+  for (int i = 0; i < 4; ++i) {
+    magic |= std::uint32_t(bytes[i]) << (8 * i);
+  }
+  if (magic != 0xFD2FB528)
+    return 0;
+
+  const std::size_t dict_id_sizes[4] = {0, 1, 2, 4};
+  const unsigned char descriptor = bytes[4];
+  // single segment frames have no window descriptor
+  std::size_t needed = prefix_size + ((descriptor & 0x20) ? 0 : 1)
+      + dict_id_sizes[descriptor & 3];
+  return size < needed ? needed - size : 0;
+}
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
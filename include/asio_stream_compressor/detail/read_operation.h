@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstring>
+
 #include "compression_core.h"
+#include "compute_executor.h"
+#include "queued_operation.h"
+#include "write_operation.h"
 
 namespace asio_stream_compressor
 {
@@ -20,6 +25,8 @@ public:
       : stream_(stream)
       , core_(core)
       , buffers_(buffers)
+      , allocator_(asio::get_associated_allocator(
+            handler, core.get_handler_allocator()))
       , handler_(std::forward<decltype(handler)>(handler))
   {
   }
@@ -28,10 +35,14 @@ public:
       : stream_(o.stream_)
       , core_(o.core_)
       , buffers_(o.buffers_)
+      , allocator_(std::move(o.allocator_))
       , handler_(std::move(o.handler_))
       , state_(o.state_)
       , ec_(o.ec_)
       , bytes_written_(o.bytes_written_)
+      , decoded_(o.decoded_)
+      , consumed_(o.consumed_)
+      , produced_(o.produced_)
   {
   }
 
@@ -42,45 +53,102 @@ public:
     do {
       switch (state_) {
         case state::initial: {
+          if (core_.decoded_buf_.size() != 0 && !core_.read_lock_.is_locked())
+          {
+            // data decoded ahead by a previous read is copied without taking
+            // the lock
+            read_decoded();
+            state_ = state::pass_decoded_data_to_handler;
+            complete_immediately();
+            return;
+          }
+
           state_ = state::lock_next_layer;
           [[fallthrough]];
         }
 
         case state::lock_next_layer: {
-          if (expiry(core_.pending_read_) == neg_infin()) {
-            core_.pending_read_.expires_at(pos_infin());
-            state_ = state::decode_data;
-            break;
-          } else {
+          state_ = state::decode_data;
+          if (!core_.read_lock_.try_lock()) {
             // wait until another read_some operation is finished
-            core_.pending_read_.async_wait(std::move(*this));
+            core_.read_lock_.wait(
+                queued_read_operation<self>::create(std::move(*this)));
             return;
           }
+          break;
         }
 
         case state::read_data_from_next_layer: {
+          if (core_.passthrough_ && core_.input_buf_.size() == 0) {
+            // the peer does not compress, data is read into the buffers as
+            // is once the reads queued before the switch are done
+            state_ = state::pass_through_data;
+            stream_.next_layer().async_read_some(buffers_, std::move(*this));
+            return;
+          }
+
+          core_.read_pending_ = true;
+          if (core_.input_buf_.pooled() && core_.input_buf_.capacity() == 0
+              && !core_.read_size_.last_read_full())
+          {
+            // the next layer is probably drained and the read may wait for
+            // long, the chunk of the pool is taken once data arrives
+            state_ = state::copy_idle_read;
+            stream_.next_layer().async_read_some(
+                asio::buffer(core_.idle_read_buf_), std::move(*this));
+            return;
+          }
+
           state_ = state::decode_data;
-          auto bufs = core_.input_buf_.prepare(65535);
+          auto bufs = core_.input_buf_.prepare(core_.read_size_.next_size());
           stream_.next_layer().async_read_some(bufs, std::move(*this));
           return;
         }
 
+        case state::copy_idle_read: {
+          if (bytes_transferred != 0) {
+            auto buf = core_.input_buf_.prepare(bytes_transferred);
+            std::memcpy(buf.data(), core_.idle_read_buf_, bytes_transferred);
+            core_.input_buf_.commit(bytes_transferred);
+            core_.stats_.rx_bytes_compressed.fetch_add(
+                bytes_transferred, std::memory_order_relaxed);
+            bytes_transferred = 0;
+          }
+          state_ = state::decode_data;
+          [[fallthrough]];
+        }
+
         case state::decode_data: {
+          core_.read_pending_ = false;
           if (ec) {
             ec_ = ec;
-            core_.pending_read_.expires_at(neg_infin());
+            unlock();
             break;
           }
 
           if (bytes_transferred != 0) {
+            core_.read_size_.on_read(bytes_transferred);
             core_.input_buf_.commit(bytes_transferred);
             core_.stats_.rx_bytes_compressed.fetch_add(
                 bytes_transferred, std::memory_order_relaxed);
           }
 
-          if (!decode_data()) {
+          if (core_.offload_to_compute(core_.input_buf_.size())) {
+            state_ = state::decode_on_compute_executor;
+            post_to_compute(
+                core_.compute_executor_, io_executor(), std::move(*this));
+            return;
+          }
+
+          decoded_ = decode_data();
+          state_ = state::check_decoded_data;
+          [[fallthrough]];
+        }
+
+        case state::check_decoded_data: {
+          if (!decoded_) {
             if (ec_) {
-              core_.pending_read_.expires_at(neg_infin());
+              unlock();
               break;
             }
 
@@ -93,82 +161,346 @@ public:
         }
 
         case state::pass_data_to_handler: {
-          // if this function is called directly from initiate function  we
-          // should call handler_ as if it was post()'ed. So we begin a zero
-          // length async read operation.
+          // if this function is called directly from initiate function the
+          // handler must not be invoked before it returns
           if (start) {
-            auto bufs = core_.input_buf_.prepare(0);
-            stream_.next_layer().async_read_some(bufs, std::move(*this));
+            complete_immediately();
             return;
           }
 
-          core_.pending_read_.expires_at(neg_infin());
+          unlock();
           core_.stats_.rx_bytes_total.fetch_add(bytes_written_,
                                                 std::memory_order_relaxed);
           handler_(ec_, bytes_written_);
           return;
         }
+
+        case state::pass_through_data: {
+          unlock();
+          core_.stats_.rx_bytes_total.fetch_add(bytes_transferred,
+                                                std::memory_order_relaxed);
+          handler_(ec, bytes_transferred);
+          return;
+        }
+
+        case state::pass_decoded_data_to_handler: {
+          core_.stats_.rx_bytes_total.fetch_add(bytes_written_,
+                                                std::memory_order_relaxed);
+          handler_(error_code(), bytes_written_);
+          return;
+        }
+
+        case state::decode_on_compute_executor: {
+          decoded_ = decode_data();
+          state_ = state::check_decoded_data;
+          post_to_io(io_executor(), std::move(*this));
+          return;
+        }
+
+        case state::report_error: {
+          break;
+        }
       }
     } while (!ec_);
 
-    // if this function is called directly from initiate function  we
-    // should call handler_ as if it was post()'ed. So we begin a zero
-    // length async read operation.
+    // if this function is called directly from initiate function the
+    // handler must not be invoked before it returns
     if (start) {
-      auto bufs = core_.input_buf_.prepare(0);
-      stream_.next_layer().async_read_some(bufs, std::move(*this));
+      state_ = state::report_error;
+      complete_immediately();
       return;
     }
     handler_(ec_, 0);
   }
 
+  using executor_type = asio::associated_executor_t<
+      Handler,
+      typename Stream::next_layer_type::executor_type>;
+
+  /**
+   * @brief get_executor - returns executor associated with the handler, so
+   * the next layer resumes the operation where the handler would run
+   */
+  executor_type get_executor() const noexcept
+  {
+    return io_executor();
+  }
+
+  using allocator_type = asio::associated_allocator_t<
+      Handler,
+      typename Core::handler_allocator_type>;
+
+  /**
+   * @brief get_allocator - returns allocator associated with the handler or
+   * the recycling allocator of the compressor if there is none
+   */
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  /**
+   * @brief resume_queued - continues the operation as the owner of the read
+   * lock. Called by the previous owner when it releases the lock.
+   */
+  void resume_queued()
+  {
+    post_to_io(io_executor(), std::move(*this));
+  }
+
 private:
+  executor_type io_executor() const noexcept
+  {
+    return asio::get_associated_executor(handler_,
+                                         stream_.next_layer().get_executor());
+  }
+
+  void complete_immediately()
+  {
+    auto io_ex = io_executor();
+    post_immediate(handler_, io_ex, std::move(*this));
+  }
+
   bool decode_data()
   {
-    bool result = false;
+    if (core_.detect_pending_ && !core_.detect_peer())
+      return false;
+
+    if (core_.passthrough_) {
+      bytes_written_ = asio::buffer_copy(buffers_, core_.input_buf_.data());
+      core_.input_buf_.consume(bytes_written_);
+      return bytes_written_ != 0;
+    }
 
+    consumed_ = 0;
+    produced_ = 0;
+    read_decoded();
+    if (core_.decoded_buf_.size() != 0) {
+      // buffers are full
+      return true;
+    }
+
+    if (decode_into_buffers() && core_.decode_ahead_size_ != 0) {
+      // keep decoding so that the next reads do not need the decoder
+      auto out = core_.decoded_buf_.prepare(core_.decode_ahead_size_);
+      ZSTD_outBuffer out_buf {out.data(), out.size(), 0};
+      if (!decode(out_buf))
+        return false;
+      core_.decoded_buf_.commit(out_buf.pos);
+    }
+
+    update_decode_credit();
+    if (produced_ != 0 && core_.decode_budget_.enabled()
+        && !core_.decode_budget_.consume(produced_))
+    {
+      ec_ = make_error_code(decode_limit_error::rate_exceeded);
+      return false;
+    }
+    return bytes_written_ != 0 && !ec_;
+  }
+
+  /**
+   * @brief read_decoded - copies data decoded ahead to the buffers
+   */
+  void read_decoded()
+  {
+    if (core_.decoded_buf_.size() == 0)
+      return;
+
+    bytes_written_ = asio::buffer_copy(buffers_, core_.decoded_buf_.data());
+    core_.decoded_buf_.consume(bytes_written_);
+  }
+
+  /**
+   * @brief decode_into_buffers - decodes to the part of the buffers that
+   * follows bytes_written_
+   * @return true if the buffers are full
+   */
+  bool decode_into_buffers()
+  {
+    std::size_t skip = bytes_written_;
     auto buffers_begin = asio::buffer_sequence_begin(buffers_);
     auto buffers_end   = asio::buffer_sequence_end(buffers_);
-    for (; buffers_begin != buffers_end;) {
-      ZSTD_outBuffer out_buf {buffers_begin->data(), buffers_begin->size(), 0};
-
-      do {
-        size_t decompression_result;
-        if (core_.input_buf_.size() == 0) {
-          ZSTD_inBuffer in_buf {nullptr, 0, 0};
-          decompression_result =
-              ZSTD_decompressStream(core_.dctx_.get(), &out_buf, &in_buf);
-          if (ZSTD_isError(decompression_result)) {
-            ec_ = make_error_code(ZSTD_getErrorCode(decompression_result));
-            return false;
-          }
+    for (; buffers_begin != buffers_end; ++buffers_begin) {
+      asio::mutable_buffer buf = *buffers_begin;
+      if (skip >= buf.size()) {
+        skip -= buf.size();
+        continue;
+      }
+      buf += skip;
+      skip = 0;
+
+      ZSTD_outBuffer out_buf {buf.data(), buf.size(), 0};
+      if (!decode(out_buf))
+        return false;
+
+      bytes_written_ += out_buf.pos;
+      if (out_buf.size != out_buf.pos)
+        return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief decode - decodes input_buf_ until out_buf is full or all input is
+   * consumed
+   * @return false on error
+   */
+  bool decode(ZSTD_outBuffer& out_buf)
+  {
+    if (!core_.dctx_) {
+      // nothing to decode before the first data arrives
+      if (core_.input_buf_.size() == 0)
+        return true;
+
+      ec_ = core_.acquire_dctx();
+      if (ec_)
+        return false;
+    }
+
+    do {
+      size_t decompression_result;
+      std::size_t out_pos = out_buf.pos;
+      if (core_.input_buf_.size() == 0) {
+        // a finished frame has no output left, and a call without input
+        // would start the next frame before its dictionary is known
+        if (core_.decoder_between_frames_)
           break;
-        } else {
-          auto in_sequence = core_.input_buf_.data();
-          auto in = asio::buffer_sequence_begin(in_sequence);
-          ZSTD_inBuffer in_buf {in->data(), in->size(), 0};
-          decompression_result =
-              ZSTD_decompressStream(core_.dctx_.get(), &out_buf, &in_buf);
-          core_.input_buf_.consume(in_buf.pos);
-        }
 
+        ZSTD_inBuffer in_buf {nullptr, 0, 0};
+        decompression_result =
+            ZSTD_decompressStream(core_.dctx_.get(), &out_buf, &in_buf);
         if (ZSTD_isError(decompression_result)) {
-          ec_ = make_error_code(ZSTD_getErrorCode(decompression_result));
+          set_decode_error(decompression_result);
           return false;
         }
-      } while (out_buf.size != out_buf.pos);
+        produced_ += out_buf.pos - out_pos;
+        core_.record_received(static_cast<char*>(out_buf.dst) + out_pos,
+                              out_buf.pos - out_pos);
+        if (!check_ratio())
+          return false;
+        core_.read_size_.on_decoded(decompression_result);
+        // between frames the decoder returns the size of the next header
+        if (decompression_result == 0) {
+          core_.decoder_between_frames_ = true;
+        }
+        break;
+      } else {
+        // the dictionary and the history must be known before the decoder
+        // reads the frame header
+        if (core_.decoder_between_frames_ && !prepare_frame()) {
+          if (ec_)
+            return false;
+          break;
+        }
 
-      if (out_buf.pos != 0)
-        result = true;
+        auto in_sequence = core_.input_buf_.data();
+        auto in = asio::buffer_sequence_begin(in_sequence);
+        ZSTD_inBuffer in_buf {in->data(), in->size(), 0};
+        decompression_result =
+            ZSTD_decompressStream(core_.dctx_.get(), &out_buf, &in_buf);
+        core_.input_buf_.consume(in_buf.pos);
+        consumed_ += in_buf.pos;
+      }
 
-      bytes_written_ += out_buf.pos;
-      if (out_buf.size == out_buf.pos)
-        ++buffers_begin;
-      else
-        break;
+      if (ZSTD_isError(decompression_result)) {
+        set_decode_error(decompression_result);
+        return false;
+      }
+      produced_ += out_buf.pos - out_pos;
+      core_.record_received(static_cast<char*>(out_buf.dst) + out_pos,
+                            out_buf.pos - out_pos);
+      if (!check_ratio())
+        return false;
+      core_.read_size_.on_decoded(decompression_result);
+      core_.decoder_between_frames_ = decompression_result == 0;
+    } while (out_buf.size != out_buf.pos);
+
+    return true;
+  }
+
+  /**
+   * @brief prepare_frame - reads the marker of a resumed session and selects
+   * the dictionary of the frame that starts input_buf_
+   * @return false on error or if more input is needed
+   */
+  bool prepare_frame()
+  {
+    if (core_.read_session_marker(ec_) != 0 || ec_)
+      return false;
+    if (core_.input_buf_.size() == 0)
+      return false;
+
+    core_.update_trained_decoder_dictionaries();
+    if (core_.has_decoder_dictionaries()) {
+      auto in_sequence = core_.input_buf_.data();
+      auto in = asio::buffer_sequence_begin(in_sequence);
+      size_t status = core_.select_decoder_dictionary(in->data(), in->size());
+      if (ZSTD_isError(status)) {
+        set_decode_error(status);
+        return false;
+      }
+      if (status != 0)
+        return false;
     }
 
-    return result;
+    ec_ = core_.apply_decoder_prefix();
+    return !ec_;
+  }
+
+  /**
+   * @brief check_ratio - checks the ratio limit after each call of the
+   * decoder, so the read stops as soon as the limit is exceeded
+   * @return false if the limit is exceeded
+   */
+  bool check_ratio()
+  {
+    std::size_t ratio = core_.decode_limits_.max_ratio();
+    std::size_t credit = core_.decode_credit_;
+    if (ratio == 0 || produced_ <= credit)
+      return true;
+
+    if ((produced_ - credit + ratio - 1) / ratio > consumed_) {
+      ec_ = make_error_code(decode_limit_error::ratio_exceeded);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief update_decode_credit - keeps the unused part of the ratio limit
+   * for the next read
+   *
+   * The decoder may return data of a block in the read after the one that
+   * received the block, but it never holds more than one block. So at most
+   * ZSTD_BLOCKSIZE_MAX bytes of credit are carried over.
+   */
+  void update_decode_credit()
+  {
+    std::size_t ratio = core_.decode_limits_.max_ratio();
+    if (ratio == 0)
+      return;
+
+    constexpr std::size_t max = (std::numeric_limits<std::size_t>::max)();
+    std::size_t earned = consumed_ > max / ratio ? max : consumed_ * ratio;
+    std::size_t allowance = earned > max - core_.decode_credit_
+        ? max
+        : earned + core_.decode_credit_;
+    std::size_t unused = allowance > produced_ ? allowance - produced_ : 0;
+    core_.decode_credit_ = (std::min)(unused, std::size_t(ZSTD_BLOCKSIZE_MAX));
+  }
+
+  void set_decode_error(size_t decompression_result)
+  {
+    ZSTD_ErrorCode code = ZSTD_getErrorCode(decompression_result);
+    if (code == ZSTD_error_frameParameter_windowTooLarge
+        && core_.decode_limits_.max_window_log() != 0)
+    {
+      ec_ = make_error_code(decode_limit_error::window_too_large);
+      return;
+    }
+    ec_ = make_error_code(code);
   }
 
   enum class state
@@ -176,18 +508,38 @@ private:
     initial,
     lock_next_layer,
     read_data_from_next_layer,
+    copy_idle_read,
     decode_data,
+    decode_on_compute_executor,
+    check_decoded_data,
     pass_data_to_handler,
+    pass_decoded_data_to_handler,
+    pass_through_data,
+    report_error,
   };
 
+  void unlock()
+  {
+    if (queued_read* next = core_.read_lock_.unlock()) {
+      next->resume();
+    }
+  }
+
   Stream& stream_;
   Core& core_;
   MutableBufferSequence buffers_;
+  // initialized from the handler before it is moved to handler_
+  allocator_type allocator_;
   Handler handler_;
 
   state state_ = state::initial;
   error_code ec_;
   size_t bytes_written_ = 0;
+  bool decoded_ = false;
+  // compressed and decoded bytes of one decode_data() call, checked by
+  // decode limits
+  size_t consumed_ = 0;
+  size_t produced_ = 0;
 };
 
 template<typename Stream, class Core>
@@ -212,6 +564,9 @@ public:
   template<class Handler, class MutableBufferSequence>
   void operator()(Handler&& handler, const MutableBufferSequence& buffers) const
   {
+    // reads in passthrough mode take the read lock too, so they do not
+    // overtake reads queued before the switch
+    watch_idle(stream_, core_);
     async_read_some_operation(
         stream_, core_, buffers, std::forward<decltype(handler)>(handler))(
         error_code(), 0, true);
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+/**
+ * @brief The read_size_controller class picks the number of bytes requested
+ * from the next layer by the next read.
+ *
+ * The decoder reports how much input it needs to finish the current block,
+ * reads that fill the whole buffer show that more data is waiting. Bulk
+ * transfers grow up to the maximum size and need fewer reads, connections
+ * with small messages keep small requests.
+ */
+class read_size_controller
+{
+public:
+  /** @brief smallest read request */
+  static constexpr std::size_t min_size = 512;
+
+  explicit read_size_controller(std::size_t max_size) noexcept
+      : max_size_(max_size)
+  {
+  }
+
+  void set_max_size(std::size_t max_size) noexcept
+  {
+    max_size_ = max_size < min_size ? min_size : max_size;
+  }
+
+  std::size_t max_size() const noexcept
+  {
+    return max_size_;
+  }
+
+  /**
+   * @brief next_size - returns size of the next read and remembers it
+   */
+  std::size_t next_size() noexcept
+  {
+    std::size_t size = size_ > hint_ ? size_ : hint_;
+    requested_ = size < min_size ? min_size
+        : size > max_size_       ? max_size_
+                                 : size;
+    return requested_;
+  }
+
+  /**
+   * @brief on_read - updates the size using the result of the last read
+   */
+  void on_read(std::size_t bytes_transferred) noexcept
+  {
+    full_ = bytes_transferred == requested_;
+    if (full_) {
+      // more data is probably waiting in the next layer
+      size_ = requested_ * 2;
+    } else if (bytes_transferred < requested_ / 4) {
+      size_ = requested_ / 2;
+    }
+  }
+
+  /**
+   * @brief last_read_full - returns true if the last read filled the whole
+   * buffer, so the next read probably does not wait
+   */
+  bool last_read_full() const noexcept
+  {
+    return full_;
+  }
+
+  /**
+   * @brief on_decoded - stores the input size hint returned by
+   * ZSTD_decompressStream()
+   */
+  void on_decoded(std::size_t hint) noexcept
+  {
+    hint_ = hint;
+  }
+
+  void reset() noexcept
+  {
+    size_ = initial_size;
+    hint_ = 0;
+    full_ = false;
+  }
+
+private:
+  static constexpr std::size_t initial_size = 4096;
+
+  std::size_t max_size_;
+  std::size_t size_ = initial_size;
+  std::size_t hint_ = 0;
+  std::size_t requested_ = 0;
+  bool full_ = false;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
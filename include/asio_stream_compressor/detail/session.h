@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace asio_stream_compressor
+{
+/**
+ * @brief The session_history class holds the end of the data a compressor
+ * exchanged with its peer, exported when the connection closes.
+ *
+ * A compressor that resumes the history primes the first frame it encodes
+ * and the first frame it decodes with it, so a reconnected pair compresses
+ * as well as the connection it replaces. The sent data of one peer is the
+ * received data of the other, so the peers agree in the handshake which
+ * directions both of them hold the same history for.
+ */
+class session_history
+{
+public:
+  session_history() = default;
+
+  session_history(std::string sent, std::string received)
+      : sent_(std::move(sent))
+      , received_(std::move(received))
+  {
+  }
+
+  /**
+   * @brief sent - returns the end of the data written to the compressor
+   */
+  const std::string& sent() const noexcept
+  {
+    return sent_;
+  }
+
+  /**
+   * @brief received - returns the end of the data read from the compressor
+   */
+  const std::string& received() const noexcept
+  {
+    return received_;
+  }
+
+  bool empty() const noexcept
+  {
+    return sent_.empty() && received_.empty();
+  }
+
+private:
+  std::string sent_;
+  std::string received_;
+};
+
+/**
+ * @brief The session_cache class keeps histories of closed connections
+ * until their peers reconnect.
+ *
+ * Histories are stored under a token both peers know, for example a session
+ * ID the server hands out. Taking a history removes it, so it is resumed
+ * once. The oldest histories are dropped when the cache is full. Copies of
+ * a cache see the same histories, so a copy can be captured by the
+ * handlers that store and take them.
+ *
+ * Example:
+ * @code
+ * // when the connection closes
+ * cache.store(token, sock.export_session());
+ * // when the peer reconnects with the token
+ * if (auto history = cache.take(token)) {
+ *   sock.resume_session(*history);
+ * }
+ * @endcode
+ */
+class session_cache
+{
+public:
+  /**
+   * @brief session_cache - creates an empty cache
+   * @param max_sessions - number of histories kept
+   */
+  explicit session_cache(std::size_t max_sessions = 1024)
+      : impl_(std::make_shared<impl>(max_sessions))
+  {
+  }
+
+  /**
+   * @brief store - keeps the history under the token, a history stored
+   * under the same token before is replaced
+   */
+  void store(const std::string& token, session_history history)
+  {
+    impl& d = *impl_;
+    std::lock_guard<std::mutex> lock(d.mutex);
+    auto it = d.index.find(token);
+    if (it != d.index.end()) {
+      d.order.erase(it->second);
+      d.index.erase(it);
+    }
+    if (d.max_sessions == 0)
+      return;
+    if (d.order.size() == d.max_sessions) {
+      d.index.erase(d.order.front().first);
+      d.order.pop_front();
+    }
+
+    d.order.emplace_back(token, std::move(history));
+    try {
+      d.index.emplace(token, std::prev(d.order.end()));
+    } catch (...) {
+      d.order.pop_back();
+      throw;
+    }
+  }
+
+  /**
+   * @brief take - removes the history stored under the token and returns it
+   */
+  std::optional<session_history> take(const std::string& token)
+  {
+    impl& d = *impl_;
+    std::lock_guard<std::mutex> lock(d.mutex);
+    auto it = d.index.find(token);
+    if (it == d.index.end())
+      return std::nullopt;
+
+    std::optional<session_history> history(std::move(it->second->second));
+    d.order.erase(it->second);
+    d.index.erase(it);
+    return history;
+  }
+
+private:
+  struct impl
+  {
+    using entry = std::pair<std::string, session_history>;
+
+    explicit impl(std::size_t capacity)
+        : max_sessions(capacity)
+    {
+    }
+
+    std::size_t max_sessions;
+    std::mutex mutex;
+    /** @brief histories from the oldest to the newest */
+    std::list<entry> order;
+    std::unordered_map<std::string, std::list<entry>::iterator> index;
+  };
+
+  std::shared_ptr<impl> impl_;
+};
+
+namespace detail
+{
+/**
+ * @brief The history_buffer class keeps the last bytes appended to it.
+ *
+ * Memory is reserved by set_capacity(), so appending never allocates.
+ */
+class history_buffer
+{
+public:
+  /**
+   * @brief set_capacity - sets number of bytes kept and drops the content
+   * @throws std::bad_alloc
+   */
+  void set_capacity(std::size_t capacity)
+  {
+    std::string data;
+    data.reserve(capacity);
+    data_.swap(data);
+    capacity_ = capacity;
+    pos_ = 0;
+  }
+
+  std::size_t capacity() const noexcept
+  {
+    return capacity_;
+  }
+
+  void clear() noexcept
+  {
+    data_.clear();
+    pos_ = 0;
+  }
+
+  void append(const void* data, std::size_t size) noexcept
+  {
+    if (capacity_ == 0)
+      return;
+
+    auto bytes = static_cast<const char*>(data);
+    if (size > capacity_) {
+      bytes += size - capacity_;
+      size = capacity_;
+    }
+    if (data_.size() != capacity_) {
+      std::size_t n = (std::min)(size, capacity_ - data_.size());
+      data_.append(bytes, n);
+      bytes += n;
+      size -= n;
+    }
+
+    // the buffer is full, the oldest bytes start at pos_
+    std::size_t n = (std::min)(size, capacity_ - pos_);
+    std::memcpy(&data_[pos_], bytes, n);
+    std::memcpy(&data_[0], bytes + n, size - n);
+    pos_ = (pos_ + size) % capacity_;
+  }
+
+  /**
+   * @brief str - returns the content from the oldest to the newest byte
+   */
+  std::string str() const
+  {
+    std::string out;
+    out.reserve(data_.size());
+    out.append(data_, pos_, std::string::npos);
+    out.append(data_, 0, pos_);
+    return out;
+  }
+
+private:
+  std::string data_;
+  std::size_t capacity_ = 0;
+  std::size_t pos_ = 0;
+};
+
+/**
+ * @brief session_marker_size - skippable frame magic, frame size and hash of
+ * the history
+ *
+ * The marker precedes the first frame of a resumed session. Decoders that
+ * do not know it skip it like any skippable frame.
+ */
+constexpr std::size_t session_marker_size = 16;
+constexpr std::uint32_t session_marker_magic = 0x184D2A5E;
+
+/**
+ * @brief history_hash - returns the FNV-1a hash of a history
+ */
+inline std::uint64_t history_hash(const std::string& history) noexcept
+{
+  std::uint64_t hash = 0xcbf29ce484222325;
+  for (char c : history) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+/**
+ * @brief write_session_marker - stores the marker of a frame primed with the
+ * history of the given hash
+ * @return number of bytes written to out
+ */
+inline std::size_t write_session_marker(unsigned char* out,
+                                        std::uint64_t hash) noexcept
+{
+  const std::uint64_t header =
+      session_marker_magic | std::uint64_t(session_marker_size - 8) << 32;
+  for (int i = 0; i < 8; ++i) {
+    out[i] = static_cast<unsigned char>(header >> (8 * i));
+    out[8 + i] = static_cast<unsigned char>(hash >> (8 * i));
+  }
+  return session_marker_size;
+}
+
+/**
+ * @brief read_session_marker - parses the marker at the start of data
+ * @return number of bytes missing from the marker, 0 if data does not start
+ * with a marker or hash was read
+ */
+inline std::size_t read_session_marker(const unsigned char* data,
+                                       std::size_t size,
+                                       bool& found,
+                                       std::uint64_t& hash) noexcept
+{
+  unsigned char header[session_marker_size];
+  write_session_marker(header, 0);
+  found = false;
+  if (std::memcmp(data, header, (std::min)(size, std::size_t(8))) != 0)
+    return 0;
+  if (size < session_marker_size)
+    return session_marker_size - size;
+
+  found = true;
+  hash = 0;
+  for (int i = 0; i < 8; ++i) {
+    hash |= std::uint64_t(data[8 + i]) << (8 * i);
+  }
+  return 0;
+}
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
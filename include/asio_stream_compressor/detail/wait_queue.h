@@ -0,0 +1,175 @@
+#pragma once
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+template<class Node>
+class wait_queue;
+
+/**
+ * @brief The wait_queue_node class is a base of objects that can be stored in
+ * the wait_queue.
+ */
+template<class Node>
+class wait_queue_node
+{
+private:
+  friend class wait_queue<Node>;
+
+  Node* next_ = nullptr;
+};
+
+/**
+ * @brief The wait_queue class is an intrusive FIFO of operations. It never
+ * allocates, the storage is provided by the nodes.
+ */
+template<class Node>
+class wait_queue
+{
+public:
+  wait_queue() noexcept = default;
+
+  wait_queue(wait_queue&& o) noexcept
+      : front_(o.front_)
+      , back_(o.back_)
+  {
+    o.front_ = nullptr;
+    o.back_ = nullptr;
+  }
+
+  wait_queue& operator=(wait_queue&& o) noexcept
+  {
+    front_ = o.front_;
+    back_ = o.back_;
+    o.front_ = nullptr;
+    o.back_ = nullptr;
+    return *this;
+  }
+
+  bool empty() const noexcept
+  {
+    return front_ == nullptr;
+  }
+
+  Node* front() const noexcept
+  {
+    return front_;
+  }
+
+  void push(Node* node) noexcept
+  {
+    node->next_ = nullptr;
+    if (back_) {
+      back_->next_ = node;
+    } else {
+      front_ = node;
+    }
+    back_ = node;
+  }
+
+  /**
+   * @brief for_each - calls f for every node from front to back
+   */
+  template<class Function>
+  void for_each(Function&& f)
+  {
+    for (Node* node = front_; node; node = node->next_) {
+      f(*node);
+    }
+  }
+
+  Node* pop() noexcept
+  {
+    Node* node = front_;
+    if (node) {
+      front_ = node->next_;
+      if (!front_) {
+        back_ = nullptr;
+      }
+      node->next_ = nullptr;
+    }
+    return node;
+  }
+
+private:
+  Node* front_ = nullptr;
+  Node* back_ = nullptr;
+};
+
+/**
+ * @brief The operation_lock class serializes asynchronous operations.
+ *
+ * An operation that fails to acquire the lock puts itself into the queue.
+ * When the lock is released ownership is passed directly to the first waiting
+ * operation, so exactly one operation is woken up and it cannot be overtaken
+ * by operations started later.
+ */
+template<class Node>
+class operation_lock
+{
+public:
+  bool is_locked() const noexcept
+  {
+    return locked_;
+  }
+
+  /**
+   * @brief try_lock - acquires the lock if it is free
+   */
+  bool try_lock() noexcept
+  {
+    if (locked_) {
+      return false;
+    }
+    locked_ = true;
+    return true;
+  }
+
+  /**
+   * @brief wait - adds an operation to the end of the queue
+   */
+  void wait(Node* node) noexcept
+  {
+    waiting_.push(node);
+  }
+
+  /**
+   * @brief peek_waiting - returns the first waiting operation without
+   * removing it from the queue
+   */
+  Node* peek_waiting() const noexcept
+  {
+    return waiting_.front();
+  }
+
+  /**
+   * @brief next_waiting - removes the first waiting operation from the queue
+   * without passing the lock to it
+   */
+  Node* next_waiting() noexcept
+  {
+    return waiting_.pop();
+  }
+
+  /**
+   * @brief unlock - releases the lock
+   * @return next owner of the lock that must be resumed by the caller or
+   * nullptr if there are no waiting operations
+   */
+  Node* unlock() noexcept
+  {
+    Node* next = waiting_.pop();
+    if (!next) {
+      locked_ = false;
+    }
+    return next;
+  }
+
+private:
+  bool locked_ = false;
+  wait_queue<Node> waiting_;
+};
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
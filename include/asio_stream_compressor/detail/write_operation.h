@@ -1,11 +1,158 @@
 #pragma once
 
+#include <algorithm>
+#include <type_traits>
+
 #include "compression_core.h"
+#include "compute_executor.h"
+#include "queued_operation.h"
+#include "raw_frame.h"
 
 namespace asio_stream_compressor
 {
 namespace detail
 {
+/**
+ * @brief The flush_request struct is an empty buffer sequence that turns
+ * async_write_some_operation into a flush operation.
+ */
+struct flush_request : asio::const_buffer
+{
+};
+
+/**
+ * @brief is_background_handler - true for handlers of flushes the compressor
+ * starts on its own. Nobody waits for them, so the compressor may be
+ * destroyed while they run.
+ */
+template<class Handler, class = void>
+struct is_background_handler : std::false_type
+{
+};
+
+template<class Handler>
+struct is_background_handler<
+    Handler,
+    std::void_t<decltype(std::declval<const Handler&>().compressor_alive())>>
+    : std::true_type
+{
+};
+
+template<class Stream, class Core>
+class background_flush_handler
+{
+public:
+  using allocator_type = typename Core::handler_allocator_type;
+
+  background_flush_handler(Core& core, std::weak_ptr<void> lifetime)
+      : core_(core)
+      , lifetime_(std::move(lifetime))
+      , allocator_(core.get_handler_allocator())
+  {
+  }
+
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  bool compressor_alive() const noexcept
+  {
+    return !lifetime_.expired();
+  }
+
+  void operator()(error_code ec)
+  {
+    if (ec && lifetime_.lock()) {
+      core_.flush_error_ = ec;
+    }
+  }
+
+private:
+  Core& core_;
+  std::weak_ptr<void> lifetime_;
+  allocator_type allocator_;
+};
+
+template<class Stream, class Core>
+class deadline_flush_handler
+{
+public:
+  using allocator_type = typename Core::handler_allocator_type;
+
+  deadline_flush_handler(Stream& stream, Core& core)
+      : stream_(stream)
+      , core_(core)
+      , lifetime_(core.lifetime_)
+      , allocator_(core.get_handler_allocator())
+  {
+  }
+
+  // the timer handler may outlive the compressor, so the allocator is kept
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  void operator()(error_code ec)
+  {
+    // the timer may have expired before the compressor was destroyed
+    if (ec || !lifetime_.lock()) {
+      return;
+    }
+
+    core_.flush_timer_armed_ = false;
+    stream_.async_flush(background_flush_handler<Stream, Core>(core_, lifetime_));
+  }
+
+private:
+  Stream& stream_;
+  Core& core_;
+  std::weak_ptr<void> lifetime_;
+  allocator_type allocator_;
+};
+
+/**
+ * @brief The pipeline_send_handler class finishes sending of one chunk of a
+ * pipelined write and resumes the write if it waits for the chunk.
+ */
+template<class Core>
+class pipeline_send_handler
+{
+public:
+  using allocator_type = typename Core::handler_allocator_type;
+
+  explicit pipeline_send_handler(Core& core)
+      : core_(core)
+      , allocator_(core.get_handler_allocator())
+  {
+  }
+
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  void operator()(error_code ec, std::size_t bytes_transferred)
+  {
+    core_.stats_.tx_bytes_compressed.fetch_add(bytes_transferred,
+                                               std::memory_order_relaxed);
+    core_.record_send_end(bytes_transferred);
+    core_.send_buf().consume(core_.send_buf().size());
+    core_.pipeline_sending_ = false;
+    if (ec && !core_.pipeline_error_) {
+      core_.pipeline_error_ = ec;
+    }
+    if (queued_write* op = std::exchange(core_.pipeline_waiting_, nullptr)) {
+      op->resume();
+    }
+  }
+
+private:
+  Core& core_;
+  allocator_type allocator_;
+};
+
 template<class Stream, class Core, class Handler, class ConstBufferSequence>
 class async_write_some_operation
 {
@@ -13,6 +160,9 @@ public:
   using self =
       async_write_some_operation<Stream, Core, Handler, ConstBufferSequence>;
 
+  static constexpr bool is_flush =
+      std::is_same<ConstBufferSequence, flush_request>::value;
+
   async_write_some_operation(Stream& stream,
                              Core& core,
                              const ConstBufferSequence& buffers,
@@ -20,6 +170,8 @@ public:
       : stream_(stream)
       , core_(core)
       , buffers_(buffers)
+      , allocator_(asio::get_associated_allocator(
+            handler, core.get_handler_allocator()))
       , handler_(std::forward<decltype(handler)>(handler))
   {
   }
@@ -29,90 +181,373 @@ public:
       , core_(o.core_)
       , buffers_(o.buffers_)
       , input_length_(o.input_length_)
+      , allocator_(std::move(o.allocator_))
       , handler_(std::move(o.handler_))
       , state_(o.state_)
       , ec_(o.ec_)
+      , batch_input_size_(o.batch_input_size_)
+      , flush_requested_(o.flush_requested_)
+      , flushed_(o.flushed_)
+      , input_encoded_(o.input_encoded_)
+      , encode_time_(o.encode_time_)
   {
   }
 
   void operator()(error_code ec,
-                  std::size_t /*bytes_transferred*/ = std::size_t(0),
+                  std::size_t bytes_transferred = std::size_t(0),
                   bool start = 0)
   {
-    switch (state_) {
-      case state::initial: {
-        state_ = state::lock_next_layer;
-        [[fallthrough]];
-      }
+    if constexpr (is_background_handler<Handler>::value) {
+      // the next layer completes the flush with an error when the compressor
+      // is destroyed, the core is gone then
+      if (!handler_.compressor_alive())
+        return;
+    }
 
-      case state::lock_next_layer: {
-        if (expiry(core_.pending_write_) == neg_infin()) {
-          core_.pending_write_.expires_at(pos_infin());
+    do {
+      switch (state_) {
+        case state::initial: {
+          state_ = state::lock_next_layer;
+          [[fallthrough]];
+        }
+
+        case state::lock_next_layer: {
           state_ = state::encode_data;
-        } else {
-          // wait until another read_some operation is finished
-          core_.pending_write_.async_wait(std::move(*this));
-          return;
+          if (!core_.write_lock_.try_lock()) {
+            // the owner of the lock will encode our data with its own
+            core_.write_lock_.wait(
+                queued_write_operation<self>::create(std::move(*this)));
+            return;
+          }
+          [[fallthrough]];
         }
-        [[fallthrough]];
-      }
 
-      case state::encode_data: {
-        encode_data();
-        if (ec_) {
-          core_.pending_write_.expires_at(neg_infin());
-          break;
+        case state::encode_data: {
+          if (core_.flush_error_) {
+            ec_ = core_.flush_error_;
+            core_.flush_error_ = error_code();
+            unlock_and_complete_batch();
+            break;
+          }
+
+          if (core_.passthrough_) {
+            // the peer does not compress, data is written as is once the
+            // writes queued before the switch are sent
+            if constexpr (is_flush) {
+              state_ = state::pass_data_to_handler;
+              if (start) {
+                complete_immediately();
+                return;
+              }
+              complete();
+              return;
+            } else {
+              state_ = state::pass_through_data;
+              stream_.next_layer().async_write_some(buffers_,
+                                                    std::move(*this));
+              return;
+            }
+          }
+
+          gather_batch();
+          if (core_.pipeline_write(batch_input_size_)) {
+            state_ = state::pipeline_encode;
+            break;
+          }
+
+          if (core_.offload_to_compute(batch_input_size_)) {
+            state_ = state::encode_on_compute_executor;
+            post_to_compute(
+                core_.compute_executor_, io_executor(), std::move(*this));
+            return;
+          }
+
+          measure_encode([this] { encode_batch(); });
+          state_ = state::check_encoded_data;
+          [[fallthrough]];
         }
 
-        state_ = state::send_data;
-        [[fallthrough]];
-      }
+        case state::check_encoded_data: {
+          if (ec_) {
+            unlock_and_complete_batch();
+            break;
+          }
 
-      case state::send_data: {
-        state_ = state::pass_data_to_handler;
-        asio::async_write(
-            stream_.next_layer(), core_.write_buf_.data(), std::move(*this));
-        return;
-      }
+          update_flush_timer();
+          core_.record_encode_time(encode_time_);
+          core_.adapt_compression_level();
+          if (core_.encode_buf().size() == 0) {
+            // nothing to send, data stays in the encoder until next flush
+            state_ = state::pass_data_to_handler;
+            if (start) {
+              complete_immediately();
+              return;
+            }
+            complete();
+            return;
+          }
+
+          state_ = state::send_data;
+          [[fallthrough]];
+        }
 
-      case state::pass_data_to_handler: {
-        if (ec) {
+        case state::send_data: {
+          state_ = state::pass_data_to_handler;
+          core_.record_send_start();
+          asio::async_write(stream_.next_layer(),
+                            core_.encode_buf().data(),
+                            std::move(*this));
+          return;
+        }
+
+        case state::pass_data_to_handler: {
+          if (bytes_transferred != 0) {
+            core_.record_send_end(bytes_transferred);
+          }
+
+          if (ec) {
+            ec_ = ec;
+            core_.encode_buf().consume(core_.encode_buf().size());
+            unlock_and_complete_batch();
+            break;
+          }
+
+          complete();
+          return;
+        }
+
+        case state::pass_through_data: {
           ec_ = ec;
-          core_.pending_write_.expires_at(neg_infin());
-          break;
+          input_length_ = bytes_transferred;
+          complete();
+          return;
         }
 
-        core_.pending_write_.expires_at(neg_infin());
-        core_.stats_.tx_bytes_total.fetch_add(input_length_,
-                                              std::memory_order_relaxed);
-        core_.stats_.tx_bytes_compressed.fetch_add(core_.write_buf_.size(),
-                                                   std::memory_order_relaxed);
-        core_.write_buf_.consume(core_.write_buf_.size());
-        handler_(ec_, input_length_);
-        return;
+        case state::encode_on_compute_executor: {
+          measure_encode([this] { encode_batch(); });
+          state_ = state::check_encoded_data;
+          post_to_io(io_executor(), std::move(*this));
+          return;
+        }
+
+        case state::pipeline_encode_on_compute_executor: {
+          measure_encode([this] { encode_chunk(); });
+          state_ = state::pipeline_send;
+          post_to_io(io_executor(), std::move(*this));
+          return;
+        }
+
+        case state::pipeline_encode: {
+          if (core_.offload_to_compute(core_.write_chunk_size())) {
+            state_ = state::pipeline_encode_on_compute_executor;
+            post_to_compute(
+                core_.compute_executor_, io_executor(), std::move(*this));
+            return;
+          }
+
+          measure_encode([this] { encode_chunk(); });
+          state_ = state::pipeline_send;
+          [[fallthrough]];
+        }
+
+        case state::pipeline_send: {
+          if (core_.pipeline_sending_) {
+            // the chunk is encoded, wait until the previous one is sent
+            core_.pipeline_waiting_ =
+                queued_write_operation<self>::create(std::move(*this));
+            return;
+          }
+
+          if (!ec_) {
+            ec_ = core_.pipeline_error_;
+          }
+          core_.pipeline_error_ = error_code();
+          if (ec_) {
+            core_.encode_buf().consume(core_.encode_buf().size());
+            unlock_and_complete_batch();
+            break;
+          }
+
+          if (core_.encode_buf().size() != 0) {
+            send_chunk();
+          }
+
+          core_.record_encode_time(encode_time_);
+          core_.adapt_compression_level();
+
+          if (!input_encoded_) {
+            // encode the next chunk while this one is being sent
+            state_ = state::pipeline_encode;
+            break;
+          }
+
+          state_ = state::pipeline_complete;
+          [[fallthrough]];
+        }
+
+        case state::pipeline_complete: {
+          if (core_.pipeline_sending_) {
+            core_.pipeline_waiting_ =
+                queued_write_operation<self>::create(std::move(*this));
+            return;
+          }
+
+          ec_ = core_.pipeline_error_;
+          core_.pipeline_error_ = error_code();
+          if (ec_) {
+            unlock_and_complete_batch();
+            break;
+          }
+
+          update_flush_timer();
+          state_ = state::pass_data_to_handler;
+          if (start) {
+            complete_immediately();
+            return;
+          }
+          complete();
+          return;
+        }
+
+        case state::report_error: {
+          break;
+        }
       }
-    }
+    } while (state_ == state::pipeline_encode);
 
-    // if this function is called directly from initiate function  we
-    // should call handler_ as if it was post()'ed. So we begin a zero
-    // length async read operation.
+    // if this function is called directly from initiate function the
+    // handler must not be invoked before it returns
     if (start) {
-      auto bufs = core_.write_buf_.prepare(0);
-      stream_.next_layer().async_read_some(bufs, std::move(*this));
+      state_ = state::report_error;
+      complete_immediately();
       return;
     }
-    handler_(ec_, 0);
+    invoke_handler(0);
+  }
+
+  using executor_type = asio::associated_executor_t<
+      Handler,
+      typename Stream::next_layer_type::executor_type>;
+
+  /**
+   * @brief get_executor - returns executor associated with the handler, so
+   * the next layer resumes the operation where the handler would run
+   */
+  executor_type get_executor() const noexcept
+  {
+    return io_executor();
+  }
+
+  using allocator_type = asio::associated_allocator_t<
+      Handler,
+      typename Core::handler_allocator_type>;
+
+  /**
+   * @brief get_allocator - returns allocator associated with the handler or
+   * the recycling allocator of the compressor if there is none
+   */
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  /**
+   * @brief resume_queued - continues the operation as the owner of the write
+   * lock. Called by the previous owner when it releases the lock.
+   */
+  void resume_queued()
+  {
+    post_to_io(io_executor(), std::move(*this));
+  }
+
+  /**
+   * @brief input_size - returns number of bytes the operation writes, at most
+   * the write limit of the compressor
+   */
+  std::size_t input_size() const noexcept
+  {
+    return (std::min)(asio::buffer_size(buffers_), core_.write_some_limit_);
+  }
+
+  /**
+   * @brief encode_batched - encodes data of the queued operation as a part
+   * of the batch of the lock owner
+   */
+  error_code encode_batched()
+  {
+    encode_data(input_size());
+    return ec_;
+  }
+
+  /**
+   * @brief complete_batched - invokes the handler of the operation whose data
+   * was sent by the owner of the write lock
+   */
+  void complete_batched(error_code ec)
+  {
+    ec_ = ec;
+    if (!ec_) {
+      core_.stats_.tx_bytes_total.fetch_add(input_length_,
+                                            std::memory_order_relaxed);
+    }
+    auto io_ex = io_executor();
+    auto alloc = get_allocator();
+    asio::post(io_ex,
+               bind_allocator(
+                   alloc,
+                   [op = std::move(*this)]() mutable
+                   { op.invoke_handler(op.ec_ ? 0 : op.input_length_); }));
   }
 
 private:
-  void encode_data()
+  void encode_data(std::size_t limit)
   {
+    core_.update_trained_encoder_dictionary();
+    // skip data encoded by previous chunks
+    std::size_t skip = input_length_;
+    std::size_t consumed = 0;
     auto buffers_begin = asio::buffer_sequence_begin(buffers_);
     auto buffers_end   = asio::buffer_sequence_end(buffers_);
-    for (auto it = buffers_begin; it != buffers_end; ++it) {
-      auto& in = *it;
-      ZSTD_inBuffer in_buf {in.data(), in.size(), 0};
-      input_length_ += in.size();
+    for (auto it = buffers_begin; it != buffers_end && consumed != limit; ++it)
+    {
+      asio::const_buffer in = *it;
+      if (skip >= in.size()) {
+        skip -= in.size();
+        continue;
+      }
+      in += skip;
+      skip = 0;
+
+      std::size_t size = (std::min)(in.size(), limit - consumed);
+      input_length_ += size;
+      consumed += size;
+      core_.record_sent(in.data(), size);
+      if (core_.bypass_encoder(in.data(), size)) {
+        encode_raw(in.data(), size);
+        if (ec_)
+          return;
+        continue;
+      }
+
+      if (!core_.cctx_) {
+        ec_ = core_.acquire_cctx();
+        if (ec_)
+          return;
+      }
+
+      if (!core_.frame_open_) {
+        ec_ = core_.apply_encoder_dictionary();
+        if (ec_)
+          return;
+        if (core_.encoder_prefix_pending_) {
+          prime_frame();
+          if (ec_)
+            return;
+        }
+      }
+
+      ZSTD_inBuffer in_buf {in.data(), size, 0};
+      core_.frame_open_ = true;
 
       while (in_buf.pos != in_buf.size) {
         ZSTD_outBuffer out_buf = get_free_buffer();
@@ -123,11 +558,175 @@ private:
                                  ZSTD_EndDirective::ZSTD_e_continue);
         if (check_set_error(compress_result))
           return;
-        core_.write_buf_.commit(out_buf.pos);
+        core_.encode_buf().commit(out_buf.pos);
+      }
+
+      if (core_.unflushed_bytes_ == 0 && core_.flush_policy_.has_deadline()) {
+        core_.unflushed_since_ = std::chrono::steady_clock::now();
+      }
+      core_.unflushed_bytes_ += size;
+    }
+  }
+
+  void encode_raw(const void* data, std::size_t size)
+  {
+    // compressed and raw blocks cannot share a frame because the encoder
+    // would not know about the raw data in the window
+    if (core_.frame_open_) {
+      end_frame();
+      if (ec_)
+        return;
+    }
+
+    // the window of the encoder may be limited for the decoder of the peer
+    unsigned max_window_log = raw_window_log_max;
+    int window_log = core_.cctx_parameter(ZSTD_c_windowLog);
+    if (window_log != 0) {
+      max_window_log = static_cast<unsigned>(window_log);
+    }
+
+    auto buf_sequence =
+        core_.encode_buf().prepare(raw_frame_size(size, max_window_log));
+    auto buf = asio::buffer_sequence_begin(buf_sequence);
+    core_.encode_buf().commit(
+        write_raw_frame(static_cast<unsigned char*>(buf->data()),
+                        static_cast<const unsigned char*>(data),
+                        size,
+                        max_window_log));
+    core_.stats_.tx_bytes_raw.fetch_add(size, std::memory_order_relaxed);
+  }
+
+  // the first frame of a resumed session refers to the history of the
+  // previous connection, the marker tells the decoder of the peer to do so
+  void prime_frame()
+  {
+    auto buf_sequence = core_.encode_buf().prepare(session_marker_size);
+    auto buf = asio::buffer_sequence_begin(buf_sequence);
+    core_.encode_buf().commit(
+        write_session_marker(static_cast<unsigned char*>(buf->data()),
+                             core_.encoder_prefix_hash_));
+    ec_ = core_.apply_encoder_prefix();
+  }
+
+  executor_type io_executor() const noexcept
+  {
+    return asio::get_associated_executor(handler_,
+                                         stream_.next_layer().get_executor());
+  }
+
+  void complete_immediately()
+  {
+    auto io_ex = io_executor();
+    post_immediate(handler_, io_ex, std::move(*this));
+  }
+
+  void gather_batch()
+  {
+    // group commit: take all writers that are waiting for the lock
+    batch_input_size_ = input_size();
+    flush_requested_ = is_flush;
+    // the owner of the lock is always encoded, other writers stay in the
+    // queue if their input would take the batch over the write limit
+    for (;;) {
+      queued_write* op = core_.write_lock_.peek_waiting();
+      if (!op || op->input_size() > core_.write_some_limit_ - batch_input_size_)
+        break;
+
+      core_.write_lock_.next_waiting();
+      core_.write_batch_.push(op);
+      batch_input_size_ += op->input_size();
+      flush_requested_ = flush_requested_ || op->is_flush();
+    }
+  }
+
+  // may be called on the compute executor, so it must not touch the lock
+  // queue or the flush timer
+  void encode_batch()
+  {
+    encode_data(input_size());
+    if (ec_)
+      return;
+
+    encode_batch_members();
+    collect_output();
+  }
+
+  // encodes the next chunk of a pipelined write, data of the other writers in
+  // the batch goes to the last chunk
+  void encode_chunk()
+  {
+    if (input_length_ != input_size()) {
+      encode_data((std::min)(core_.write_chunk_size(),
+                             input_size() - input_length_));
+      if (ec_ || input_length_ != input_size()) {
+        collect_output();
+        return;
       }
     }
 
-    // flush remaining
+    encode_batch_members();
+    input_encoded_ = true;
+    collect_output();
+  }
+
+  void encode_batch_members()
+  {
+    core_.write_batch_.for_each(
+        [this](queued_write& op)
+        {
+          if (!ec_) {
+            ec_ = op.encode();
+          }
+        });
+    if (ec_)
+      return;
+
+    if (should_flush(flush_requested_)) {
+      flush_data();
+    }
+  }
+
+  void send_chunk()
+  {
+    // the encoded chunk becomes the send buffer, the encoder continues with
+    // the buffer of the previous chunk
+    core_.pipeline_swapped_ = !core_.pipeline_swapped_;
+    core_.pipeline_sending_ = true;
+    core_.record_send_start();
+    asio::async_write(
+        stream_.next_layer(),
+        core_.send_buf().data(),
+        asio::bind_executor(io_executor(), pipeline_send_handler<Core>(core_)));
+  }
+
+  bool should_flush(bool flush_requested) const
+  {
+    if (flush_requested)
+      return true;
+
+    const auto& policy = core_.flush_policy_;
+    if (core_.unflushed_bytes_ >= policy.max_pending_bytes())
+      return true;
+    return policy.has_deadline() && core_.unflushed_bytes_ != 0
+        && std::chrono::steady_clock::now() - core_.unflushed_since_
+        >= policy.max_delay();
+  }
+
+  void flush_data()
+  {
+    flushed_ = true;
+    if (core_.unflushed_bytes_ == 0
+        && !(core_.end_frame_on_flush_ && core_.frame_open_))
+    {
+      return;
+    }
+
+    if (core_.end_frame_on_flush_) {
+      // the new compression level applies to the next frame
+      end_frame();
+      return;
+    }
+
     size_t compress_result;
     ZSTD_inBuffer in_buf {nullptr, 0, 0};
     do {
@@ -136,15 +735,134 @@ private:
                                              &out_buf,
                                              &in_buf,
                                              ZSTD_EndDirective::ZSTD_e_flush);
-      core_.write_buf_.commit(out_buf.pos);
+      core_.encode_buf().commit(out_buf.pos);
       if (check_set_error(compress_result))
         return;
     } while (compress_result != 0);
+    core_.unflushed_bytes_ = 0;
+  }
+
+  void update_flush_timer()
+  {
+    if (flushed_) {
+      core_.cancel_flush_timer();
+    } else {
+      arm_flush_timer();
+    }
+  }
+
+  // takes output the workers of a multithreaded encoder produced so far
+  // without waiting for running jobs. ZSTD_toFlushNow() is experimental,
+  // without it the output is taken when the write ends.
+  void collect_output()
+  {
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+    if (core_.workers_ == 0 || flushed_ || ec_ || !core_.cctx_)
+      return;
+
+    ZSTD_inBuffer in_buf {nullptr, 0, 0};
+    while (ZSTD_toFlushNow(core_.cctx_.get()) != 0) {
+      ZSTD_outBuffer out_buf = get_free_buffer();
+      size_t compress_result =
+          ZSTD_compressStream2(core_.cctx_.get(),
+                               &out_buf,
+                               &in_buf,
+                               ZSTD_EndDirective::ZSTD_e_continue);
+      core_.encode_buf().commit(out_buf.pos);
+      if (check_set_error(compress_result))
+        return;
+    }
+#endif
+  }
+
+  void end_frame()
+  {
+    size_t compress_result;
+    ZSTD_inBuffer in_buf {nullptr, 0, 0};
+    do {
+      ZSTD_outBuffer out_buf = get_free_buffer();
+      compress_result = ZSTD_compressStream2(core_.cctx_.get(),
+                                             &out_buf,
+                                             &in_buf,
+                                             ZSTD_EndDirective::ZSTD_e_end);
+      core_.encode_buf().commit(out_buf.pos);
+      if (check_set_error(compress_result))
+        return;
+    } while (compress_result != 0);
+    core_.frame_open_ = false;
+    core_.end_frame_on_flush_ = false;
+    core_.unflushed_bytes_ = 0;
+    flushed_ = true;
+  }
+
+  // may be called on the compute executor, the time is passed to the level
+  // controller by the I/O executor
+  template<class Function>
+  void measure_encode(Function&& encode)
+  {
+    if (!core_.level_controller_.enabled()) {
+      encode();
+      return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    encode();
+    encode_time_ = std::chrono::steady_clock::now() - start;
+  }
+
+  void arm_flush_timer()
+  {
+    const auto& policy = core_.flush_policy_;
+    if (core_.flush_timer_armed_ || core_.unflushed_bytes_ == 0
+        || !policy.has_deadline())
+    {
+      return;
+    }
+
+    core_.flush_timer_armed_ = true;
+    expires_after(core_.flush_timer_,
+                  core_.unflushed_since_ + policy.max_delay()
+                      - std::chrono::steady_clock::now());
+    core_.flush_timer_.async_wait(
+        deadline_flush_handler<Stream, Core>(stream_, core_));
+  }
+
+  void complete()
+  {
+    core_.stats_.tx_bytes_total.fetch_add(input_length_,
+                                          std::memory_order_relaxed);
+    core_.stats_.tx_bytes_compressed.fetch_add(core_.encode_buf().size(),
+                                               std::memory_order_relaxed);
+    core_.encode_buf().consume(core_.encode_buf().size());
+    unlock_and_complete_batch();
+    invoke_handler(input_length_);
+  }
+
+  void unlock_and_complete_batch()
+  {
+    // pass the lock directly to the next writer so it cannot be overtaken
+    if (queued_write* next = core_.write_lock_.unlock()) {
+      next->resume();
+    }
+
+    while (queued_write* op = core_.write_batch_.pop()) {
+      op->complete(ec_);
+    }
+  }
+
+  void invoke_handler(size_t bytes_transferred)
+  {
+    if constexpr (is_flush) {
+      (void)bytes_transferred;
+      handler_(ec_);
+    } else {
+      handler_(ec_, bytes_transferred);
+    }
   }
 
   ZSTD_outBuffer get_free_buffer()
   {
-    auto buf_sequence = core_.write_buf_.prepare(ZSTD_DStreamOutSize());
+    auto buf_sequence = core_.encode_buf().prepare(ZSTD_DStreamOutSize());
     auto buf = asio::buffer_sequence_begin(buf_sequence);
     return ZSTD_outBuffer {buf->data(), buf->size(), 0};
   }
@@ -163,20 +881,175 @@ private:
     initial,
     lock_next_layer,
     encode_data,
+    encode_on_compute_executor,
+    check_encoded_data,
     send_data,
     pass_data_to_handler,
+    pass_through_data,
+    pipeline_encode,
+    pipeline_encode_on_compute_executor,
+    pipeline_send,
+    pipeline_complete,
+    report_error,
   };
 
   Stream& stream_;
   Core& core_;
   ConstBufferSequence buffers_;
   size_t input_length_ = 0;
+  // initialized from the handler before it is moved to handler_
+  allocator_type allocator_;
   Handler handler_;
 
   state state_ = state::initial;
   error_code ec_;
+  size_t batch_input_size_ = 0;
+  bool flush_requested_ = false;
+  bool flushed_ = false;
+  bool input_encoded_ = false;
+  std::chrono::steady_clock::duration encode_time_ {};
 };
 
+/**
+ * @brief The idle_flush_handler class releases the encoder after the idle
+ * timer ended its frame.
+ */
+template<class Core>
+class idle_flush_handler
+{
+public:
+  using allocator_type = typename Core::handler_allocator_type;
+
+  idle_flush_handler(Core& core, std::weak_ptr<void> lifetime)
+      : core_(core)
+      , lifetime_(std::move(lifetime))
+      , allocator_(core.get_handler_allocator())
+  {
+  }
+
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  bool compressor_alive() const noexcept
+  {
+    return !lifetime_.expired();
+  }
+
+  void operator()(error_code ec)
+  {
+    if (!lifetime_.lock())
+      return;
+
+    if (ec) {
+      core_.flush_error_ = ec;
+      return;
+    }
+    core_.hibernate_encoder();
+  }
+
+private:
+  Core& core_;
+  std::weak_ptr<void> lifetime_;
+  allocator_type allocator_;
+};
+
+/**
+ * @brief The idle_timer_handler class hibernates a compressor that did not
+ * start any operation since the timer was armed.
+ *
+ * The timer is not rearmed by every operation. An operation only bumps a
+ * counter and the handler arms the timer again if the counter changed, so
+ * the connection hibernates between one and two idle times after its last
+ * operation. The timer is also armed again while the decoder is in the
+ * middle of a frame.
+ */
+template<class Stream, class Core>
+class idle_timer_handler
+{
+public:
+  using allocator_type = typename Core::handler_allocator_type;
+
+  idle_timer_handler(Stream& stream, Core& core)
+      : stream_(stream)
+      , core_(core)
+      , lifetime_(core.lifetime_)
+      , allocator_(core.get_handler_allocator())
+  {
+  }
+
+  allocator_type get_allocator() const noexcept
+  {
+    return allocator_;
+  }
+
+  static void arm(Stream& stream, Core& core)
+  {
+    core.idle_timer_armed_ = true;
+    core.idle_activity_ = core.activity_;
+    expires_after(core.idle_timer_, core.idle_time_);
+    core.idle_timer_.async_wait(idle_timer_handler(stream, core));
+  }
+
+  void operator()(error_code ec)
+  {
+    // the timer may have expired before the compressor was destroyed
+    if (ec || !lifetime_.lock()) {
+      return;
+    }
+
+    core_.idle_timer_armed_ = false;
+    // hibernation may have been disabled after the timer expired
+    if (core_.idle_time_ == std::chrono::steady_clock::duration::zero())
+      return;
+
+    if (core_.activity_ != core_.idle_activity_) {
+      arm(stream_, core_);
+      return;
+    }
+
+    if (!core_.hibernate_decoder()) {
+      // the peer may end its frame later, check again after the next period
+      arm(stream_, core_);
+    }
+    if (!core_.frame_open_ || core_.write_lock_.is_locked()) {
+      core_.hibernate_encoder();
+      return;
+    }
+
+    // the encoder keeps its window until the frame is ended, the flush is
+    // started directly so it does not count as activity
+    core_.end_frame_on_flush_ = true;
+    async_write_some_operation<Stream,
+                               Core,
+                               idle_flush_handler<Core>,
+                               flush_request>(
+        stream_,
+        core_,
+        flush_request(),
+        idle_flush_handler<Core>(core_, lifetime_))(error_code(), 0, true);
+  }
+
+private:
+  Stream& stream_;
+  Core& core_;
+  std::weak_ptr<void> lifetime_;
+  allocator_type allocator_;
+};
+
+/**
+ * @brief watch_idle - records the start of an operation and arms the idle
+ * timer if hibernation is enabled
+ */
+template<class Stream, class Core>
+void watch_idle(Stream& stream, Core& core)
+{
+  if (core.note_activity()) {
+    idle_timer_handler<Stream, Core>::arm(stream, core);
+  }
+}
+
 template<typename Stream, class Core>
 class initiate_async_write_some
 {
@@ -199,6 +1072,12 @@ public:
   template<class Handler, class ConstBufferSequence>
   void operator()(Handler&& handler, const ConstBufferSequence& buffers) const
   {
+    // writes in passthrough mode take the write lock too, so they are not
+    // interleaved with compressed writes started before the switch
+    watch_idle(stream_, core_);
+    if (!core_.passthrough_) {
+      core_.sample_write(buffers);
+    }
     async_write_some_operation(
         stream_, core_, buffers, std::forward<decltype(handler)>(handler))(
         error_code(), 0, true);
@@ -209,5 +1088,40 @@ private:
   Core& core_;
 };
 
+template<typename Stream, class Core>
+class initiate_async_flush
+{
+public:
+  using executor_type = typename Stream::executor_type;
+
+  initiate_async_flush(Stream& stream, Core& core)
+      : stream_(stream)
+      , core_(core)
+  {
+  }
+  initiate_async_flush(const initiate_async_flush&) = default;
+  initiate_async_flush(initiate_async_flush&&) = default;
+
+  executor_type get_executor() const noexcept
+  {
+    return stream_.get_executor();
+  }
+
+  template<class Handler>
+  void operator()(Handler&& handler) const
+  {
+    watch_idle(stream_, core_);
+    async_write_some_operation(stream_,
+                               core_,
+                               flush_request(),
+                               std::forward<decltype(handler)>(handler))(
+        error_code(), 0, true);
+  }
+
+private:
+  Stream& stream_;
+  Core& core_;
+};
+
 }  // namespace detail
 }  // namespace asio_stream_compressor
@@ -0,0 +1,21 @@
+#pragma once
+
+// Define ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL to enable the features that
+// need declarations from the experimental sections of zstd.h and zdict.h:
+// compression_thread_pool, set_static_memory(), zstd contexts allocated with
+// the compressor allocator, early output of compression workers and tuned
+// dictionary training. The experimental API may change between zstd
+// releases, so the library must then be the version the headers come from,
+// usually a static libzstd. Without the macro only the stable API is used.
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+#  ifndef ZSTD_STATIC_LINKING_ONLY
+#    define ZSTD_STATIC_LINKING_ONLY
+#  endif
+#  ifndef ZDICT_STATIC_LINKING_ONLY
+#    define ZDICT_STATIC_LINKING_ONLY
+#  endif
+#endif
+
+#include <zdict.h>
+#include <zstd.h>
+#include <zstd_errors.h>
@@ -60,6 +60,130 @@ inline error_condition make_error_condition(ZSTD_ErrorCode e)
   return error_condition(e, zstd_error_category());
 }
 
+/**
+ * @brief The decode_limit_error enum lists errors of reads that exceed
+ * decode_limits.
+ */
+enum class decode_limit_error
+{
+  window_too_large = 1,  ///< frame window is larger than max_window_log
+  ratio_exceeded,  ///< read decoded too many bytes per compressed byte
+  rate_exceeded,  ///< decoder produced more bytes per second than allowed
+};
+
+class decode_limit_category_impl : public error_category
+{
+public:
+  // error_category interface
+  const char* name() const noexcept override
+  {
+    return "decode_limit";
+  }
+
+  std::string message(int ev) const override
+  {
+    switch (static_cast<decode_limit_error>(ev)) {
+      case decode_limit_error::window_too_large:
+        return "Frame window exceeds the decode limit";
+      case decode_limit_error::ratio_exceeded:
+        return "Decoded data exceeds the compression ratio limit";
+      case decode_limit_error::rate_exceeded:
+        return "Decoded data exceeds the rate limit";
+    }
+    return "Unknown decode limit error";
+  }
+};
+
+inline const error_category& decode_limit_category()
+{
+  static decode_limit_category_impl instance;
+  return instance;
+}
+
+inline error_code make_error_code(decode_limit_error e)
+{
+  return error_code(static_cast<int>(e), decode_limit_category());
+}
+
+/**
+ * @brief The handshake_error enum lists errors of async_handshake().
+ */
+enum class handshake_error
+{
+  invalid_record = 1,  ///< peer sent something that is not a handshake
+  unsupported_version,  ///< peer uses a newer handshake format
+};
+
+class handshake_category_impl : public error_category
+{
+public:
+  // error_category interface
+  const char* name() const noexcept override
+  {
+    return "handshake";
+  }
+
+  std::string message(int ev) const override
+  {
+    switch (static_cast<handshake_error>(ev)) {
+      case handshake_error::invalid_record:
+        return "Peer did not send a handshake record";
+      case handshake_error::unsupported_version:
+        return "Peer uses an unsupported handshake version";
+    }
+    return "Unknown handshake error";
+  }
+};
+
+inline const error_category& handshake_category()
+{
+  static handshake_category_impl instance;
+  return instance;
+}
+
+inline error_code make_error_code(handshake_error e)
+{
+  return error_code(static_cast<int>(e), handshake_category());
+}
+
+/**
+ * @brief The session_error enum lists errors of resumed sessions.
+ */
+enum class session_error
+{
+  history_mismatch = 1,  ///< peer primed its encoder with another history
+};
+
+class session_category_impl : public error_category
+{
+public:
+  // error_category interface
+  const char* name() const noexcept override
+  {
+    return "session";
+  }
+
+  std::string message(int ev) const override
+  {
+    switch (static_cast<session_error>(ev)) {
+      case session_error::history_mismatch:
+        return "Peer resumed a session with a different history";
+    }
+    return "Unknown session error";
+  }
+};
+
+inline const error_category& session_category()
+{
+  static session_category_impl instance;
+  return instance;
+}
+
+inline error_code make_error_code(session_error e)
+{
+  return error_code(static_cast<int>(e), session_category());
+}
+
 }  // namespace asio_stream_compressor
 
 namespace std
@@ -69,3 +193,50 @@ struct is_error_condition_enum<ZSTD_ErrorCode> : public true_type
 {
 };
 }  // namespace std
+
+#ifdef ASIO_STEREAM_COMPRESSOR_FLAVOUR_STANDALONE
+namespace std
+{
+template<>
+struct is_error_code_enum<asio_stream_compressor::decode_limit_error>
+    : public true_type
+{
+};
+
+template<>
+struct is_error_code_enum<asio_stream_compressor::handshake_error>
+    : public true_type
+{
+};
+
+template<>
+struct is_error_code_enum<asio_stream_compressor::session_error>
+    : public true_type
+{
+};
+}  // namespace std
+#else
+namespace boost
+{
+namespace system
+{
+template<>
+struct is_error_code_enum<asio_stream_compressor::decode_limit_error>
+    : public std::true_type
+{
+};
+
+template<>
+struct is_error_code_enum<asio_stream_compressor::handshake_error>
+    : public std::true_type
+{
+};
+
+template<>
+struct is_error_code_enum<asio_stream_compressor::session_error>
+    : public std::true_type
+{
+};
+}  // namespace system
+}  // namespace boost
+#endif
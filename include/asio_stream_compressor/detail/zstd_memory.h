@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "zstd_api.h"
+
+namespace asio_stream_compressor
+{
+namespace detail
+{
+struct zstd_cstream_deleter
+{
+  /** @brief memory of the context, empty for the default allocator */
+  std::shared_ptr<void> memory;
+
+  void operator()(ZSTD_CCtx* ptr)
+  {
+    ZSTD_freeCStream(ptr);
+  }
+};
+
+struct zstd_dstream_deleter
+{
+  /** @brief memory of the context, empty for the default allocator */
+  std::shared_ptr<void> memory;
+
+  void operator()(ZSTD_DCtx* ptr)
+  {
+    ZSTD_freeDStream(ptr);
+  }
+};
+
+using zstd_cstream_uptr = std::unique_ptr<ZSTD_CStream, zstd_cstream_deleter>;
+using zstd_dstream_uptr = std::unique_ptr<ZSTD_DStream, zstd_dstream_deleter>;
+
+/**
+ * @brief The zstd_memory class passes allocations of zstd contexts to a
+ * standard allocator.
+ *
+ * zstd frees memory without its size, so every block starts with a header
+ * that keeps it. The object must stay at the same address while contexts use
+ * it, so it is always allocated on the heap. zstd takes custom allocators
+ * only through its experimental API, so without
+ * ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL contexts use the default zstd
+ * allocator.
+ */
+template<class Allocator>
+class zstd_memory
+{
+public:
+  explicit zstd_memory(const Allocator& alloc) noexcept
+      : alloc_(alloc)
+  {
+  }
+
+  zstd_memory(const zstd_memory&) = delete;
+  zstd_memory& operator=(const zstd_memory&) = delete;
+
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  ZSTD_customMem custom_mem() noexcept
+  {
+    return {&zstd_memory::allocate, &zstd_memory::deallocate, this};
+  }
+#endif
+
+private:
+  struct alignas(std::max_align_t) header
+  {
+    std::size_t units;
+  };
+
+  using header_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<header>;
+
+  static void* allocate(void* opaque, std::size_t size) noexcept
+  {
+    auto* self = static_cast<zstd_memory*>(opaque);
+    std::size_t units = (size + sizeof(header) - 1) / sizeof(header) + 1;
+    try {
+      header* h = header_allocator(self->alloc_).allocate(units);
+      h->units = units;
+      return h + 1;
+    } catch (...) {
+      // zstd reports memory_allocation error
+      return nullptr;
+    }
+  }
+
+  static void deallocate(void* opaque, void* address) noexcept
+  {
+    if (!address)
+      return;
+
+    auto* self = static_cast<zstd_memory*>(opaque);
+    header* h = static_cast<header*>(address) - 1;
+    header_allocator(self->alloc_).deallocate(h, h->units);
+  }
+
+  Allocator alloc_;
+};
+
+/**
+ * @brief make_zstd_memory - returns memory for zstd contexts of a compressor
+ * or nullptr if zstd should use its default allocator
+ */
+template<class Allocator>
+std::shared_ptr<zstd_memory<Allocator>> make_zstd_memory(
+    const Allocator& alloc)
+{
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  using value_type = typename std::allocator_traits<Allocator>::value_type;
+  // std::allocator and zstd use the same heap, nothing to route
+  if (std::is_same<Allocator, std::allocator<value_type>>::value)
+    return nullptr;
+
+  return std::allocate_shared<zstd_memory<Allocator>>(alloc, alloc);
+#else
+  (void)alloc;
+  return nullptr;
+#endif
+}
+
+/**
+ * @brief zstd_workspace - memory of a static zstd context, aligned as zstd
+ * requires
+ */
+template<class Allocator>
+using zstd_workspace = std::vector<
+    std::max_align_t,
+    typename std::allocator_traits<Allocator>::template rebind_alloc<
+        std::max_align_t>>;
+
+/**
+ * @brief make_zstd_cstream - creates an encoder context that allocates from
+ * memory or with the default zstd allocator if memory is empty
+ */
+template<class Allocator>
+zstd_cstream_uptr make_zstd_cstream(
+    const std::shared_ptr<zstd_memory<Allocator>>& memory) noexcept
+{
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  if (memory) {
+    return zstd_cstream_uptr(ZSTD_createCCtx_advanced(memory->custom_mem()),
+                             zstd_cstream_deleter {memory});
+  }
+#else
+  (void)memory;
+#endif
+  return zstd_cstream_uptr(ZSTD_createCCtx());
+}
+
+/**
+ * @brief make_zstd_dstream - creates a decoder context that allocates from
+ * memory or with the default zstd allocator if memory is empty
+ */
+template<class Allocator>
+zstd_dstream_uptr make_zstd_dstream(
+    const std::shared_ptr<zstd_memory<Allocator>>& memory) noexcept
+{
+#ifdef ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL
+  if (memory) {
+    return zstd_dstream_uptr(ZSTD_createDCtx_advanced(memory->custom_mem()),
+                             zstd_dstream_deleter {memory});
+  }
+#else
+  (void)memory;
+#endif
+  return zstd_dstream_uptr(ZSTD_createDCtx());
+}
+
+}  // namespace detail
+}  // namespace asio_stream_compressor
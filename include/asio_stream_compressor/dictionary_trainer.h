@@ -0,0 +1,3 @@
+#pragma once
+
+#include "detail/dictionary_trainer.h"
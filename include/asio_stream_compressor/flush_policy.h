@@ -0,0 +1,3 @@
+#pragma once
+
+#include "detail/flush_policy.h"
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory_resource>
+
+#include "asio_stream_compressor.h"
+
+namespace asio_stream_compressor
+{
+namespace pmr
+{
+/**
+ * @brief compressor - compressor that takes all of its memory from a
+ * std::pmr::memory_resource, including the zstd contexts that hold most of it
+ * when ASIO_STREAM_COMPRESSOR_ZSTD_EXPERIMENTAL is defined
+ *
+ * A resource per shard keeps codec memory local to the threads that use it,
+ * for example a pool over NUMA-local or huge-page-backed memory.
+ *
+ * Example:
+ * @code
+ * std::pmr::unsynchronized_pool_resource arena(shard_upstream_resource);
+ * asio_stream_compressor::pmr::compressor<ip::tcp::socket> sock(
+ *     ctx, 3, std::pmr::polymorphic_allocator<char>(&arena));
+ * @endcode
+ *
+ * @warning polymorphic_allocator cannot be assigned, so these compressors can
+ * be move constructed but not move assigned.
+ */
+template<class Stream, class Codec = zstd_codec>
+using compressor = asio_stream_compressor::
+    compressor<Stream, std::pmr::polymorphic_allocator<char>, Codec>;
+
+}  // namespace pmr
+}  // namespace asio_stream_compressor
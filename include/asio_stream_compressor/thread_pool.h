@@ -0,0 +1,3 @@
+#pragma once
+
+#include "detail/compression_thread_pool.h"
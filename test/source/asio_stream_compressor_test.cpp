@@ -0,0 +1,962 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <asio_stream_compressor/asio_stream_compressor.h>
+#include <asio_stream_compressor/detail/raw_frame.h>
+#include <zdict.h>
+#include <zstd.h>
+
+#ifdef ASIO_STREAM_COMPRESSOR_TEST_LZ4
+#include <asio_stream_compressor/lz4_codec.h>
+#endif
+
+#ifdef ASIO_STEREAM_COMPRESSOR_FLAVOUR_STANDALONE
+#include <asio.hpp>
+#else
+#include <boost/asio.hpp>
+#endif
+
+#if __has_include(<catch2/catch_test_macros.hpp>)
+#include <catch2/catch_test_macros.hpp>
+#else
+#include <catch2/catch.hpp>
+#endif
+
+namespace
+{
+std::atomic<std::size_t> heap_allocations {0};
+}  // namespace
+
+// every heap allocation of the test binary is counted
+void* operator new(std::size_t size)
+{
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size != 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+// gcc pairs the inlined free() with the new expression of the caller
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace asio = asio_stream_compressor::asio;
+namespace ip = asio::ip;
+
+namespace
+{
+using compressor = asio_stream_compressor::compressor<ip::tcp::socket>;
+
+std::string make_message(std::size_t size)
+{
+  std::minstd_rand rng(size);
+  std::string message(size, '\0');
+  for (auto& c : message) {
+    c = static_cast<char>(rng());
+  }
+  return message;
+}
+
+/**
+ * @brief The ping_pong class writes a message from one compressor and reads
+ * it with the other until the given number of cycles is done. Allocations
+ * are counted from the end of the warm-up cycles.
+ */
+class ping_pong
+{
+public:
+  ping_pong(compressor& writer, compressor& reader, std::string message)
+      : writer_(writer)
+      , reader_(reader)
+      , message_(std::move(message))
+      , received_(message_.size(), '\0')
+  {
+  }
+
+  void run(asio::io_context& ctx, std::size_t warm_up, std::size_t cycles)
+  {
+    warm_up_ = warm_up;
+    cycles_ = warm_up + cycles;
+    asio::post(ctx, [this] { start(); });
+    ctx.restart();
+    ctx.run();
+    allocations_ = heap_allocations.load() - allocations_;
+  }
+
+  std::size_t failures() const noexcept
+  {
+    return failures_;
+  }
+
+  std::size_t allocations() const noexcept
+  {
+    return allocations_;
+  }
+
+private:
+  void start()
+  {
+    if (cycles_ == 0)
+      return;
+    if (cycles_-- == warm_up_) {
+      allocations_ = heap_allocations.load();
+    }
+
+    asio::async_write(writer_,
+                      asio::buffer(message_),
+                      [this](asio_stream_compressor::error_code ec, std::size_t)
+                      {
+                        if (ec)
+                          ++failures_;
+                      });
+    asio::async_read(reader_,
+                     asio::buffer(received_),
+                     [this](asio_stream_compressor::error_code ec, std::size_t)
+                     {
+                       if (ec || received_ != message_) {
+                         ++failures_;
+                         return;
+                       }
+                       start();
+                     });
+  }
+
+  compressor& writer_;
+  compressor& reader_;
+  std::string message_;
+  std::string received_;
+  std::size_t warm_up_ = 0;
+  std::size_t cycles_ = 0;
+  std::size_t failures_ = 0;
+  std::size_t allocations_ = 0;
+};
+
+/**
+ * @brief The counting_socket class counts writes to the socket, so tests can
+ * tell when a compressor sends data to its next layer.
+ */
+class counting_socket : public ip::tcp::socket
+{
+public:
+  using ip::tcp::socket::socket;
+
+  template<class ConstBufferSequence, class WriteHandler>
+  auto async_write_some(const ConstBufferSequence& buffers,
+                        WriteHandler&& handler)
+  {
+    ++writes;
+    return ip::tcp::socket::async_write_some(
+        buffers, std::forward<WriteHandler>(handler));
+  }
+
+  std::size_t writes = 0;
+};
+
+using counting_compressor =
+    asio_stream_compressor::compressor<counting_socket>;
+
+/**
+ * @brief connect_pair - connects two sockets over loopback, like a
+ * socketpair
+ */
+void connect_pair(asio::io_context& ctx, ip::tcp::socket& a, ip::tcp::socket& b)
+{
+  ip::tcp::acceptor acceptor(ctx,
+                             ip::tcp::endpoint(ip::address_v4::loopback(), 0));
+  a.connect(acceptor.local_endpoint());
+  acceptor.accept(b);
+}
+
+template<class Compressor>
+void connect_pair(asio::io_context& ctx, Compressor& a, Compressor& b)
+{
+  ip::tcp::socket& a_socket = a.next_layer();
+  ip::tcp::socket& b_socket = b.next_layer();
+  connect_pair(ctx, a_socket, b_socket);
+}
+
+/**
+ * @brief make_dictionary - trains a dictionary on small JSON records
+ */
+asio_stream_compressor::dictionary make_dictionary()
+{
+  std::string samples;
+  std::vector<std::size_t> sizes;
+  for (std::size_t i = 0; i < 2000; ++i) {
+    std::string sample = "{\"id\": " + std::to_string(i * 7919 % 10007)
+        + ", \"name\": \"user" + std::to_string(i)
+        + "\", \"status\": \"active\", \"groups\": [\"staff\"]}";
+    samples += sample;
+    sizes.push_back(sample.size());
+  }
+  std::string dict(4096, '\0');
+  std::size_t size = ZDICT_trainFromBuffer(&dict[0],
+                                           dict.size(),
+                                           samples.data(),
+                                           sizes.data(),
+                                           static_cast<unsigned>(sizes.size()));
+  REQUIRE(!ZDICT_isError(size));
+  return asio_stream_compressor::dictionary(dict.data(), size);
+}
+
+/**
+ * @brief handshake - runs async_handshake() on both compressors
+ * @return error codes of a and b
+ */
+std::pair<asio_stream_compressor::error_code,
+          asio_stream_compressor::error_code>
+handshake(asio::io_context& ctx,
+          compressor& a,
+          const asio_stream_compressor::handshake_options& a_options,
+          compressor& b,
+          const asio_stream_compressor::handshake_options& b_options)
+{
+  std::pair<asio_stream_compressor::error_code,
+            asio_stream_compressor::error_code>
+      result;
+  a.async_handshake(a_options,
+                    [&](asio_stream_compressor::error_code ec)
+                    { result.first = ec; });
+  b.async_handshake(b_options,
+                    [&](asio_stream_compressor::error_code ec)
+                    { result.second = ec; });
+  ctx.restart();
+  ctx.run();
+  return result;
+}
+
+/**
+ * @brief transfer - writes the message with one compressor and reads it
+ * with the other
+ * @return the first error of the write or the read
+ */
+template<class Compressor>
+asio_stream_compressor::error_code transfer(asio::io_context& ctx,
+                                            Compressor& writer,
+                                            Compressor& reader,
+                                            const std::string& message,
+                                            std::string& received)
+{
+  asio_stream_compressor::error_code write_ec;
+  asio_stream_compressor::error_code read_ec;
+  received.assign(message.size(), '\0');
+  asio::async_write(writer,
+                    asio::buffer(message),
+                    [&](asio_stream_compressor::error_code ec, std::size_t)
+                    { write_ec = ec; });
+  asio::async_read(reader,
+                   asio::buffer(&received[0], received.size()),
+                   [&](asio_stream_compressor::error_code ec, std::size_t)
+                   { read_ec = ec; });
+  ctx.restart();
+  ctx.run();
+  return write_ec ? write_ec : read_ec;
+}
+
+/**
+ * @brief write_message - writes the message and runs the context until no
+ * work is left
+ */
+template<class Compressor>
+asio_stream_compressor::error_code write_message(asio::io_context& ctx,
+                                                 Compressor& writer,
+                                                 const std::string& message)
+{
+  asio_stream_compressor::error_code write_ec;
+  asio::async_write(writer,
+                    asio::buffer(message),
+                    [&](asio_stream_compressor::error_code ec, std::size_t)
+                    { write_ec = ec; });
+  ctx.restart();
+  ctx.run();
+  return write_ec;
+}
+
+/**
+ * @brief read_message - reads size bytes and runs the context until no work
+ * is left
+ */
+template<class Compressor>
+std::string read_message(asio::io_context& ctx,
+                         Compressor& reader,
+                         std::size_t size,
+                         asio_stream_compressor::error_code& ec)
+{
+  std::string received(size, '\0');
+  asio::async_read(reader,
+                   asio::buffer(&received[0], received.size()),
+                   [&](asio_stream_compressor::error_code e, std::size_t)
+                   { ec = e; });
+  ctx.restart();
+  ctx.run();
+  return received;
+}
+
+/**
+ * @brief make_text - returns size bytes of text that compresses well
+ */
+std::string make_text(std::size_t size)
+{
+  std::string text;
+  for (std::size_t i = 0; text.size() < size; ++i) {
+    text += "{\"id\": " + std::to_string(i) + ", \"status\": \"active\"}\n";
+  }
+  text.resize(size);
+  return text;
+}
+
+/**
+ * @brief round_trip - sends messages of several sizes through a pair of
+ * compressors with the codec in both directions
+ */
+template<class Codec>
+void round_trip()
+{
+  using codec_compressor =
+      asio_stream_compressor::compressor<ip::tcp::socket,
+                                         std::allocator<char>,
+                                         Codec>;
+
+  asio::io_context ctx;
+  codec_compressor a(ctx);
+  codec_compressor b(ctx);
+  connect_pair(ctx, a, b);
+
+  std::string received;
+  for (std::size_t size : {std::size_t(1),
+                           std::size_t(1000),
+                           std::size_t(64 * 1024),
+                           std::size_t(300 * 1024)})
+  {
+    CAPTURE(size);
+    const std::string text = make_text(size);
+    REQUIRE(!transfer(ctx, a, b, text, received));
+    CHECK(received == text);
+    const std::string message = make_message(size);
+    REQUIRE(!transfer(ctx, b, a, message, received));
+    CHECK(received == message);
+  }
+}
+
+}  // namespace
+
+TEST_CASE("reads and writes do not allocate after warm-up", "[allocation]")
+{
+  asio::io_context ctx;
+  compressor writer(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+
+  // buffers, zstd contexts and the operation memory of the compressors are
+  // allocated during the warm-up. zstd allocates with malloc and is not
+  // counted, it keeps its workspaces between frames.
+  ping_pong test(writer, reader, make_message(200));
+  test.run(ctx, 1000, 1000000);
+
+  REQUIRE(test.failures() == 0);
+  CHECK(test.allocations() == 0);
+}
+
+TEST_CASE("a resumed session is primed only if both peers hold its history",
+          "[session]")
+{
+  using asio_stream_compressor::handshake_options;
+  using asio_stream_compressor::session_history;
+
+  asio::io_context ctx;
+  const std::string message = make_message(4096);
+  std::string received;
+
+  session_history sent;
+  session_history read;
+  {
+    compressor writer(ctx);
+    compressor reader(ctx);
+    connect_pair(ctx, writer, reader);
+    REQUIRE(!writer.set_session_history(64 * 1024));
+    REQUIRE(!reader.set_session_history(64 * 1024));
+    auto ec = handshake(
+        ctx, writer, handshake_options(), reader, handshake_options());
+    REQUIRE(!ec.first);
+    REQUIRE(!ec.second);
+    REQUIRE(!transfer(ctx, writer, reader, message, received));
+    sent = writer.export_session();
+    read = reader.export_session();
+  }
+
+  compressor writer(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+  REQUIRE(!writer.resume_session(sent));
+
+  // the message repeats the history, only a primed frame is much smaller
+  bool primed = false;
+  SECTION("both peers resume")
+  {
+    REQUIRE(!reader.resume_session(read));
+    primed = true;
+  }
+  SECTION("the reader does not resume") {}
+  SECTION("the reader resumes another history")
+  {
+    REQUIRE(!reader.resume_session(session_history("", "other")));
+  }
+
+  auto ec =
+      handshake(ctx, writer, handshake_options(), reader, handshake_options());
+  REQUIRE(!ec.first);
+  REQUIRE(!ec.second);
+  REQUIRE(!transfer(ctx, writer, reader, message, received));
+  CHECK(received == message);
+
+  auto compressed = writer.get_statistics().tx_bytes_compressed.load();
+  if (primed) {
+    CHECK(compressed < message.size() / 4);
+  } else {
+    CHECK(compressed > message.size());
+  }
+}
+
+TEST_CASE("an idle read holds no chunk of the buffer pool", "[buffer_pool]")
+{
+  asio::io_context ctx;
+  asio_stream_compressor::buffer_pool pool;
+  compressor writer(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+  writer.set_buffer_pool(pool);
+  reader.set_buffer_pool(pool);
+
+  const std::string message = make_message(64 * 1024);
+  std::string received;
+  REQUIRE(!transfer(ctx, writer, reader, message, received));
+  CHECK(received == message);
+  std::size_t idle_footprint = reader.memory_footprint();
+
+  // the read waits for data that is sent later
+  char byte = 0;
+  std::size_t bytes_read = 0;
+  reader.async_read_some(asio::buffer(&byte, 1),
+                         [&](asio_stream_compressor::error_code, std::size_t n)
+                         { bytes_read = n; });
+  ctx.restart();
+  ctx.poll();
+  CHECK(reader.memory_footprint() == idle_footprint);
+
+  asio_stream_compressor::error_code write_ec;
+  asio_stream_compressor::error_code read_ec;
+  received.assign(message.size() - 1, '\0');
+  asio::async_write(writer,
+                    asio::buffer(message),
+                    [&](asio_stream_compressor::error_code ec, std::size_t)
+                    { write_ec = ec; });
+  ctx.restart();
+  ctx.run();
+  REQUIRE(!write_ec);
+  REQUIRE(bytes_read == 1);
+  CHECK(byte == message[0]);
+
+  asio::async_read(reader,
+                   asio::buffer(&received[0], received.size()),
+                   [&](asio_stream_compressor::error_code ec, std::size_t)
+                   { read_ec = ec; });
+  ctx.restart();
+  ctx.run();
+  REQUIRE(!read_ec);
+  CHECK(received == message.substr(1));
+}
+
+TEST_CASE("raw frames are decoded by ZSTD_decompressStream", "[raw_frame]")
+{
+  using asio_stream_compressor::detail::raw_block_max_size;
+  using asio_stream_compressor::detail::raw_frame_size;
+  using asio_stream_compressor::detail::write_raw_frame;
+
+  // the window of the encoder, the decoder accepts no larger frames
+  unsigned window_log = 17;
+  SECTION("largest window") {}
+  SECTION("limited window")
+  {
+    window_log = 14;
+  }
+
+  for (std::size_t size : {std::size_t(0),
+                           std::size_t(1),
+                           raw_block_max_size,
+                           raw_block_max_size + 1,
+                           3 * raw_block_max_size + 100})
+  {
+    CAPTURE(size, window_log);
+    const std::string message = make_message(size);
+    std::vector<unsigned char> frame(raw_frame_size(size, window_log));
+    std::size_t frame_size = write_raw_frame(
+        frame.data(),
+        reinterpret_cast<const unsigned char*>(message.data()),
+        message.size(),
+        window_log);
+    REQUIRE(frame_size == frame.size());
+
+    // one byte more than expected shows a frame that decodes too much
+    std::string decoded(size + 1, '\0');
+    std::unique_ptr<ZSTD_DStream, decltype(&ZSTD_freeDStream)> dstream(
+        ZSTD_createDStream(), &ZSTD_freeDStream);
+    REQUIRE(!ZSTD_isError(ZSTD_DCtx_setParameter(
+        dstream.get(), ZSTD_d_windowLogMax, static_cast<int>(window_log))));
+    ZSTD_inBuffer in {frame.data(), frame.size(), 0};
+    ZSTD_outBuffer out {&decoded[0], decoded.size(), 0};
+    std::size_t result = ZSTD_decompressStream(dstream.get(), &out, &in);
+    REQUIRE(!ZSTD_isError(result));
+    CHECK(result == 0);
+    CHECK(in.pos == frame.size());
+    REQUIRE(out.pos == size);
+    decoded.resize(size);
+    CHECK(decoded == message);
+  }
+}
+
+TEST_CASE("the handshake limits the encoder window to the peer decoder",
+          "[handshake]")
+{
+  using asio_stream_compressor::handshake_options;
+
+  asio::io_context ctx;
+  compressor writer(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+  // the default level picks a larger window for data of unknown size
+  REQUIRE(!reader.set_decode_limits(
+      asio_stream_compressor::decode_limits().max_window_log(14)));
+
+  auto ec =
+      handshake(ctx, writer, handshake_options(), reader, handshake_options());
+  REQUIRE(!ec.first);
+  REQUIRE(!ec.second);
+
+  const std::string message = make_message(256 * 1024);
+  std::string received;
+  REQUIRE(!transfer(ctx, writer, reader, message, received));
+  CHECK(received == message);
+
+  // incompressible data is sent in raw frames, which keep the window too
+  writer.set_raw_bypass(1024, 7.0);
+  const std::string raw = make_message(128 * 1024);
+  auto raw_bytes = writer.get_statistics().tx_bytes_raw.load();
+  REQUIRE(!transfer(ctx, writer, reader, raw, received));
+  CHECK(received == raw);
+  CHECK(writer.get_statistics().tx_bytes_raw.load() > raw_bytes);
+}
+
+TEST_CASE("the handshake skips a dictionary the peer does not announce",
+          "[handshake]")
+{
+  using asio_stream_compressor::handshake_options;
+
+  asio::io_context ctx;
+  compressor a(ctx);
+  compressor b(ctx);
+  connect_pair(ctx, a, b);
+
+  // both encoders hold the dictionary, only a can decode with it
+  auto dict = make_dictionary();
+  a.set_encoder_dictionary(dict);
+  b.set_encoder_dictionary(dict);
+  REQUIRE(!a.add_decoder_dictionary(dict));
+
+  auto ec = handshake(ctx, a, handshake_options(), b, handshake_options());
+  REQUIRE(!ec.first);
+  REQUIRE(!ec.second);
+
+  const std::string message =
+      "{\"id\": 42, \"name\": \"user42\", \"status\": \"active\"}";
+  std::string received;
+  REQUIRE(!transfer(ctx, a, b, message, received));
+  CHECK(received == message);
+  REQUIRE(!transfer(ctx, b, a, message, received));
+  CHECK(received == message);
+}
+
+TEST_CASE("compression(false) on one side passes data through",
+          "[handshake]")
+{
+  using asio_stream_compressor::handshake_options;
+
+  asio::io_context ctx;
+  compressor a(ctx);
+  compressor b(ctx);
+  connect_pair(ctx, a, b);
+
+  auto ec = handshake(
+      ctx, a, handshake_options().compression(false), b, handshake_options());
+  REQUIRE(!ec.first);
+  REQUIRE(!ec.second);
+
+  const std::string message = "plain text on the wire";
+  std::string received;
+  REQUIRE(!transfer(ctx, a, b, message, received));
+  CHECK(received == message);
+
+  // the peer that asked for compression sends the data as is too
+  asio_stream_compressor::error_code write_ec;
+  asio::async_write(b,
+                    asio::buffer(message),
+                    [&](asio_stream_compressor::error_code e, std::size_t)
+                    { write_ec = e; });
+  ctx.restart();
+  ctx.run();
+  REQUIRE(!write_ec);
+  received.assign(message.size(), '\0');
+  asio::read(a.next_layer(), asio::buffer(&received[0], received.size()));
+  CHECK(received == message);
+}
+
+TEST_CASE("a record with bad magic or version fails the handshake",
+          "[handshake]")
+{
+  using asio_stream_compressor::handshake_error;
+  using asio_stream_compressor::detail::handshake_record;
+
+  unsigned char record[handshake_record::max_size];
+  std::size_t size = handshake_record().write(record);
+  handshake_error expected = handshake_error::invalid_record;
+  SECTION("bad magic")
+  {
+    record[0] = 'X';
+  }
+  SECTION("unknown version")
+  {
+    record[4] = handshake_record::version + 1;
+    expected = handshake_error::unsupported_version;
+  }
+
+  asio::io_context ctx;
+  compressor a(ctx);
+  ip::tcp::socket peer(ctx);
+  connect_pair(ctx, a.next_layer(), peer);
+  asio::write(peer, asio::buffer(record, size));
+
+  asio_stream_compressor::error_code handshake_ec;
+  a.async_handshake([&](asio_stream_compressor::error_code e)
+                    { handshake_ec = e; });
+  ctx.run();
+  CHECK(handshake_ec == make_error_code(expected));
+}
+
+TEST_CASE("identity codec round trip", "[codec]")
+{
+  round_trip<asio_stream_compressor::identity_codec>();
+}
+
+#ifdef ASIO_STREAM_COMPRESSOR_TEST_LZ4
+TEST_CASE("lz4 codec round trip", "[codec]")
+{
+  round_trip<asio_stream_compressor::lz4_codec>();
+}
+#endif
+
+TEST_CASE("the level preferred by the peer is capped", "[handshake]")
+{
+  using asio_stream_compressor::handshake_options;
+
+  asio::io_context ctx;
+  compressor a(ctx);
+  compressor b(ctx);
+  connect_pair(ctx, a, b);
+  const int level = a.get_compression_level();
+
+  handshake_options a_options;
+  handshake_options b_options;
+  int expected = level;
+  SECTION("by the level in use")
+  {
+    b_options.preferred_level(22);
+  }
+  SECTION("by max_level")
+  {
+    a_options.max_level(level + 2);
+    b_options.preferred_level(22);
+    expected = level + 2;
+  }
+  SECTION("a lower level is taken")
+  {
+    b_options.preferred_level(1);
+    expected = 1;
+  }
+  SECTION("an unknown level is ignored")
+  {
+    a_options.max_level(22);
+    b_options.preferred_level(1000);
+  }
+
+  auto ec = handshake(ctx, a, a_options, b, b_options);
+  REQUIRE(!ec.first);
+  REQUIRE(!ec.second);
+  CHECK(a.get_compression_level() == expected);
+
+  const std::string message = make_message(1000);
+  std::string received;
+  REQUIRE(!transfer(ctx, a, b, message, received));
+  CHECK(received == message);
+}
+
+TEST_CASE("an armed flush deadline does not outlive its compressor",
+          "[flush]")
+{
+  // timer handlers refer to the compressor that armed them
+  STATIC_REQUIRE(!std::is_move_constructible<compressor>::value);
+  STATIC_REQUIRE(!std::is_move_assignable<compressor>::value);
+
+  asio::io_context ctx;
+  auto original = std::make_unique<compressor>(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, *original, reader);
+  original->set_flush_policy(asio_stream_compressor::flush_policy::deadline(
+      std::chrono::milliseconds(10)));
+
+  const std::string message = make_message(1000);
+  asio_stream_compressor::error_code write_ec;
+  asio::async_write(*original,
+                    asio::buffer(message),
+                    [&](asio_stream_compressor::error_code e, std::size_t)
+                    { write_ec = e; });
+  ctx.poll();
+  REQUIRE(!write_ec);
+
+  // the timer expires after the compressor is destroyed
+  original.reset();
+  ctx.restart();
+  ctx.run();
+}
+
+TEST_CASE("flush policies decide when the peer gets the data", "[flush]")
+{
+  using asio_stream_compressor::flush_policy;
+
+  asio::io_context ctx;
+  counting_compressor writer(ctx);
+  counting_compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+  const std::string message = make_message(100);
+  asio_stream_compressor::error_code ec;
+
+  SECTION("manual policy waits for async_flush()")
+  {
+    writer.set_flush_policy(flush_policy::manual());
+    REQUIRE(!write_message(ctx, writer, message));
+    CHECK(writer.next_layer().writes == 0);
+
+    asio_stream_compressor::error_code flush_ec;
+    writer.async_flush([&](asio_stream_compressor::error_code e)
+                       { flush_ec = e; });
+    CHECK(read_message(ctx, reader, message.size(), ec) == message);
+    REQUIRE(!flush_ec);
+    REQUIRE(!ec);
+    CHECK(writer.next_layer().writes != 0);
+  }
+  SECTION("threshold policy flushes once enough bytes were written")
+  {
+    writer.set_flush_policy(flush_policy::threshold(250));
+    REQUIRE(!write_message(ctx, writer, message));
+    REQUIRE(!write_message(ctx, writer, message));
+    CHECK(writer.next_layer().writes == 0);
+
+    REQUIRE(!write_message(ctx, writer, message));
+    CHECK(writer.next_layer().writes != 0);
+    CHECK(read_message(ctx, reader, 3 * message.size(), ec)
+          == message + message + message);
+    REQUIRE(!ec);
+  }
+  SECTION("deadline policy flushes after the delay")
+  {
+    writer.set_flush_policy(
+        flush_policy::deadline(std::chrono::milliseconds(20)));
+    asio::async_write(writer,
+                      asio::buffer(message),
+                      [&](asio_stream_compressor::error_code e, std::size_t)
+                      { ec = e; });
+    ctx.poll();
+    REQUIRE(!ec);
+    CHECK(writer.next_layer().writes == 0);
+
+    auto start = std::chrono::steady_clock::now();
+    CHECK(read_message(ctx, reader, message.size(), ec) == message);
+    REQUIRE(!ec);
+    CHECK(std::chrono::steady_clock::now() - start
+          >= std::chrono::milliseconds(10));
+  }
+}
+
+TEST_CASE("queued writes are sent with one flush", "[batching]")
+{
+  asio::io_context ctx;
+  counting_compressor writer(ctx);
+  counting_compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+
+  // the first write runs alone, the ones queued behind it share a flush
+  const std::string messages[] = {
+      make_message(100), make_message(200), make_message(300)};
+  std::string expected;
+  std::size_t completed = 0;
+  for (const auto& message : messages) {
+    expected += message;
+    asio::async_write(writer,
+                      asio::buffer(message),
+                      [&](asio_stream_compressor::error_code ec, std::size_t)
+                      {
+                        if (!ec)
+                          ++completed;
+                      });
+  }
+
+  asio_stream_compressor::error_code ec;
+  CHECK(read_message(ctx, reader, expected.size(), ec) == expected);
+  REQUIRE(!ec);
+  CHECK(completed == 3);
+  CHECK(writer.next_layer().writes == 2);
+}
+
+TEST_CASE("codec work runs on the compute executor", "[compute]")
+{
+  asio::io_context ctx;
+  asio::thread_pool pool(2);
+  compressor a(ctx);
+  compressor b(ctx);
+  connect_pair(ctx, a, b);
+  a.set_compute_executor(pool.get_executor(), 1024);
+  b.set_compute_executor(pool.get_executor(), 1024);
+
+  std::string received;
+  for (std::size_t size : {std::size_t(100), std::size_t(256 * 1024)}) {
+    CAPTURE(size);
+    const std::string text = make_text(size);
+    REQUIRE(!transfer(ctx, a, b, text, received));
+    CHECK(received == text);
+    const std::string message = make_message(size);
+    REQUIRE(!transfer(ctx, b, a, message, received));
+    CHECK(received == message);
+  }
+  pool.join();
+}
+
+TEST_CASE("async_write_some reports the bytes consumed under a limit",
+          "[write_some_limit]")
+{
+  asio::io_context ctx;
+  compressor writer(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+  writer.set_write_some_limit(1000);
+
+  const std::string message = make_message(5000);
+  asio_stream_compressor::error_code ec;
+  std::size_t written = 0;
+  writer.async_write_some(asio::buffer(message),
+                          [&](asio_stream_compressor::error_code e,
+                              std::size_t n)
+                          {
+                            ec = e;
+                            written = n;
+                          });
+  ctx.run();
+  REQUIRE(!ec);
+  CHECK(written == 1000);
+
+  // async_write() continues from the reported count
+  REQUIRE(!write_message(ctx, writer, message.substr(written)));
+  CHECK(read_message(ctx, reader, message.size(), ec) == message);
+  REQUIRE(!ec);
+}
+
+TEST_CASE("decode limits reject frames an untrusted peer sends",
+          "[decode_limits]")
+{
+  using asio_stream_compressor::decode_limit_error;
+  using asio_stream_compressor::decode_limits;
+
+  asio::io_context ctx;
+  compressor writer(ctx);
+  compressor reader(ctx);
+  connect_pair(ctx, writer, reader);
+
+  std::string message;
+  decode_limit_error expected = decode_limit_error::window_too_large;
+  SECTION("window larger than max_window_log")
+  {
+    // the default level picks a larger window for data of unknown size
+    REQUIRE(!reader.set_decode_limits(decode_limits().max_window_log(14)));
+    message = make_message(1000);
+  }
+  SECTION("ratio above max_ratio")
+  {
+    REQUIRE(!reader.set_decode_limits(decode_limits().max_ratio(10)));
+    message.assign(1024 * 1024, '\0');
+    expected = decode_limit_error::ratio_exceeded;
+  }
+
+  asio_stream_compressor::error_code ec;
+  asio::async_write(writer,
+                    asio::buffer(message),
+                    [](asio_stream_compressor::error_code, std::size_t) {});
+  read_message(ctx, reader, message.size(), ec);
+  CHECK(ec == make_error_code(expected));
+}
+
+TEST_CASE("auto-detect accepts plain and compressing peers", "[auto_detect]")
+{
+  asio::io_context ctx;
+  compressor server(ctx);
+  server.set_auto_detect(true);
+  const std::string request = "GET / HTTP/1.0\r\n\r\n";
+  const std::string response = "HTTP/1.0 200 OK\r\n\r\n";
+  asio_stream_compressor::error_code ec;
+
+  SECTION("plain peer")
+  {
+    ip::tcp::socket client(ctx);
+    connect_pair(ctx, client, server.next_layer());
+    asio::write(client, asio::buffer(request));
+    CHECK(read_message(ctx, server, request.size(), ec) == request);
+    REQUIRE(!ec);
+
+    // the reply is passed through as is
+    REQUIRE(!write_message(ctx, server, response));
+    std::string received(response.size(), '\0');
+    asio::read(client, asio::buffer(&received[0], received.size()));
+    CHECK(received == response);
+  }
+  SECTION("compressing peer")
+  {
+    compressor client(ctx);
+    connect_pair(ctx, client, server);
+    std::string received;
+    REQUIRE(!transfer(ctx, client, server, request, received));
+    CHECK(received == request);
+    REQUIRE(!transfer(ctx, server, client, response, received));
+    CHECK(received == response);
+  }
+}